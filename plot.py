@@ -1,5 +1,5 @@
 #!/usr/bin/env python3
-import json, glob, collections, os
+import json, glob, collections, os, struct
 import matplotlib.pyplot as plt
 import numpy as np
 from datetime import datetime
@@ -25,15 +25,78 @@ def extract_records(data):
         return data["tasks"], data.get("timestamp", 0)
     return data, 0
 
-files = sorted(glob.glob("./scx/task_ctx_*.json"))
-if not files:
-    raise SystemExit("no samples found in ./scx/task_ctx_*.json")
+# .scxs 快照文件格式（见 snapshot.h）
+SNAP_PATH = "./scx/task_ctx.scxs"
+SNAP_HDR = struct.Struct("<8sIIIIq32x")
+SNAP_FRAME = struct.Struct("<IHHqIIQ")
+SNAP_FRAME_MAGIC = 0x314d5246
+SNAP_FRAME_KEY = 1
+# task_snapshot 中绘图用到的字段及其偏移
+SNAP_RECORD_FIELDS = {"pid": 0, "current_gua": 72, "assigned_cpu": 76, "current_element": 80}
+
+def load_scxs(path):
+    """回放 .scxs：关键帧重置任务集合，增量帧更新变化的任务并删除已退出的任务"""
+    with open(path, "rb") as f:
+        buf = f.read()
+    magic, version, hdr_size, rec_size, _, _ = SNAP_HDR.unpack_from(buf, 0)
+    if magic.rstrip(b"\0") != b"SCXSNAP" or version != 1:
+        raise SystemExit(f"{path}: not a snapshot file")
+    dtype = np.dtype({
+        "names": list(SNAP_RECORD_FIELDS),
+        "formats": ["<u4"] * len(SNAP_RECORD_FIELDS),
+        "offsets": list(SNAP_RECORD_FIELDS.values()),
+        "itemsize": rec_size,
+    })
+
+    samples = []
+    tasks = {}
+    off = hdr_size
+    while off + SNAP_FRAME.size <= len(buf):
+        fmagic, ftype, _, ts_ns, nr, nr_removed, _ = SNAP_FRAME.unpack_from(buf, off)
+        removed_len = (nr_removed * 4 + 7) & ~7
+        end = off + SNAP_FRAME.size + nr * rec_size + removed_len
+        if fmagic != SNAP_FRAME_MAGIC or end > len(buf):
+            break  # 末尾未写完的帧
+        recs = np.frombuffer(buf, dtype=dtype, count=nr, offset=off + SNAP_FRAME.size)
+        if ftype == SNAP_FRAME_KEY:
+            tasks = {}
+        else:
+            removed = np.frombuffer(buf, dtype="<u4", count=nr_removed,
+                                    offset=off + SNAP_FRAME.size + nr * rec_size)
+            for pid in removed.tolist():
+                tasks.pop(pid, None)
+        for r in recs.tolist():
+            tasks[r[0]] = {"pid": r[0], "current_gua": r[1], "assigned_cpu": r[2], "current_element": r[3]}
+        samples.append((ts_ns // 1_000_000_000, list(tasks.values())))
+        off = end
+    return samples
+
+def load_json_samples():
+    """旧格式：每个采样周期一份 task_ctx_<ts>.json"""
+    samples = []
+    for fpath in sorted(glob.glob("./scx/task_ctx_*.json")):
+        try:
+            frecs, fts = extract_records(load(fpath))
+        except Exception as e:
+            print(f"Warning: skip {fpath}: {e}")
+            continue
+        # 提取时间戳从文件名或数据
+        fname = os.path.basename(fpath)
+        try:
+            fts = int(fname.split('_')[2].split('.')[0])
+        except (IndexError, ValueError):
+            pass
+        samples.append((fts, frecs))
+    return samples
+
+samples = load_scxs(SNAP_PATH) if os.path.exists(SNAP_PATH) else load_json_samples()
+if not samples:
+    raise SystemExit(f"no samples found in {SNAP_PATH} or ./scx/task_ctx_*.json")
 
 os.makedirs("./scx", exist_ok=True)
 
 # === 快照分析（最后一次采样）===
-data = load(files[-1])
-records, ts = extract_records(data)
+ts, records = samples[-1]
 
 gua_cnt = collections.Counter()
 cpu_cnt = collections.Counter()
@@ -131,43 +194,29 @@ fig.savefig("./scx/04_gua_cpu_heatmap.png", dpi=120)
 plt.close(fig)
 
 # === 时间序列分析 ===
-if len(files) > 1:
+if len(samples) > 1:
     timeline = []
     gua_timeline = {i: [] for i in range(8)}
     cpu_timeline = {i: [] for i in range(max(cpus) + 1) if i in cpus}
     
-    for fpath in files:
-        try:
-            fdata = load(fpath)
-            frecs, fts = extract_records(fdata)
-            
-            # 提取时间戳从文件名或数据
-            fname = os.path.basename(fpath)
-            try:
-                ts_from_name = int(fname.split('_')[2].split('.')[0])
-            except:
-                ts_from_name = fts
-            
-            timeline.append(ts_from_name)
-            
-            # 统计本次快照的卦象和CPU分布
-            snap_gua = collections.Counter()
-            snap_cpu = collections.Counter()
-            for rec in frecs:
-                if isinstance(rec, dict) and "value" in rec:
-                    rec = rec["value"]
-                if not isinstance(rec, dict):
-                    continue
-                snap_gua[rec.get("current_gua", 0)] += 1
-                snap_cpu[rec.get("assigned_cpu", 0)] += 1
-            
-            for i in range(8):
-                gua_timeline[i].append(snap_gua.get(i, 0))
-            for cpu in cpu_timeline:
-                cpu_timeline[cpu].append(snap_cpu.get(cpu, 0))
-        except Exception as e:
-            print(f"Warning: skip {fpath}: {e}")
-            continue
+    for fts, frecs in samples:
+        timeline.append(fts)
+        
+        # 统计本次快照的卦象和CPU分布
+        snap_gua = collections.Counter()
+        snap_cpu = collections.Counter()
+        for rec in frecs:
+            if isinstance(rec, dict) and "value" in rec:
+                rec = rec["value"]
+            if not isinstance(rec, dict):
+                continue
+            snap_gua[rec.get("current_gua", 0)] += 1
+            snap_cpu[rec.get("assigned_cpu", 0)] += 1
+        
+        for i in range(8):
+            gua_timeline[i].append(snap_gua.get(i, 0))
+        for cpu in cpu_timeline:
+            cpu_timeline[cpu].append(snap_cpu.get(cpu, 0))
     
     if len(timeline) > 1:
         # 图5: 卦象时间序列
@@ -203,6 +252,6 @@ print("  01_gua_dist.png       - 卦象分布柱状图")
 print("  02_cpu_dist.png       - CPU分配分布柱状图")
 print("  03_element_pie.png    - 五行元素分布饼图")
 print("  04_gua_cpu_heatmap.png - 卦象-CPU映射热力图")
-if len(files) > 1:
+if len(samples) > 1:
     print("  05_gua_timeline.png   - 卦象时间序列折线图")
     print("  06_cpu_timeline.png   - CPU分配时间序列折线图")
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_core_read.h>
 
+#include "user_exit_info.h"
+
 // 卦象定义
 enum yijing_gua {
     GUA_KUN  = 0, // 000 坤：极阴
@@ -24,6 +26,19 @@ struct task_ctx {
     u64 enqueue_time;   // 入队时间，用于计算运行/等待时长
     u32 assigned_cpu;   // 分配的 CPU
     u32 current_element; // 当前五行元素
+    u32 partner_pid;    // 最近一次唤醒本任务的 waker（伙伴）
+    u32 partner_streak; // 被同一伙伴连续唤醒的次数
+    u32 waker_cpu;      // 本次唤醒时 waker 所在的 CPU
+    u32 place_local;    // select_cpu 已选定目标 CPU（伙伴亲和/缓存热），enqueue 直接放入本地队列
+    u32 last_cpu;       // 上次实际运行的 CPU
+    u32 migrations;     // 跨 CPU 迁移次数
+    u64 last_ran_at;    // 上次停止运行的时间，用于判断缓存是否仍热
+    u64 running_at;     // 本次开始运行的时间，用于 cgroup 记账
+    u64 cgrp_id;        // 所属 cgroup（cpu 控制器视角，与 cgroup_init/cgroup_move 一致）
+    u64 lat_eligible;   // 延迟类：可运行时间（按预留速率折算已用时间）
+    u64 lat_deadline;   // 延迟类：本次激活的虚拟截止时间，0 表示已检查过
+    u32 last_dsq;       // 上次插入的 DSQ（1-9，0 表示本地/全局队列），用于统计排队时长
+    u32 reserved;
 };
 
 struct {
@@ -33,12 +48,37 @@ struct {
     __type(value, struct task_ctx);
 } task_ctx_map SEC(".maps");
 
+/* 任务快照记录：由 iter/task 程序输出的二进制流（与用户态 sched.c 保持一致） */
+struct task_snapshot {
+    u32 pid;
+    u32 tgid;
+    char comm[16];
+    u64 cgrp_id;          // 所属 cgroup id
+    u64 sum_exec_runtime; // 累计运行时间（ns）
+    u64 nvcsw;            // 自愿上下文切换次数
+    u64 nivcsw;           // 非自愿上下文切换次数
+    s64 rss_pages;        // 常驻内存页数（文件页 + 匿名页 + 共享内存页）
+    u64 enqueue_time;
+    u32 current_gua;
+    u32 assigned_cpu;
+    u32 current_element;
+    u32 last_cpu;
+    u32 migrations;
+    u32 partner_pid;
+};
+
 /* 系统配置信息 */
 struct sys_config {
     u32 num_cpus;      // CPU总数
     u32 num_perf_cpus; // 性能核心数
     u32 num_eff_cpus;  // 能效核心数
-    u32 reserved[5];   // 预留字段
+    u32 cache_hot_us;      // 缓存热窗口（微秒），RSS 为阳时按倍数放大
+    u32 sticky_max_queued; // 上次 CPU 本地队列超过该长度视为过载，允许迁移；0 表示只粘空队列
+    u32 cgroup_bw;         // 非零时按 cpu.max 对 cgroup 限流
+    u32 latency_cap_pct;   // 延迟类可占用的 CPU 上限（占全部在线 CPU 的百分比）
+    u32 dispatch_batch;    // 每次 dispatch 最多搬运的任务数（BPF 侧限制在 DISPATCH_BATCH_MAX 以内）
+    u32 dispatch_budget_us; // 一批任务的时间片总和上限（微秒），限制后到的高优先级任务的等待
+    u32 reserved[2];   // 预留字段
 };
 
 struct {
@@ -48,10 +88,230 @@ struct {
     __type(value, struct sys_config);
 } sys_config_map SEC(".maps");
 
+#define MAX_CPUS 256
+
+/* 每个 CPU 的拓扑信息（由用户态加载器写入） */
+struct cpu_topo {
+    u32 llc_id;        // 末级缓存（LLC）编号
+    u32 offline;       // 非零表示已下线（cpu_offline 回调即时更新）
+    u32 is_perf;       // 非零表示性能核心
+    u32 present;       // 非零表示加载器或 cpu_online 写过该项；未写过的下标（含 nr_cpu_ids 及以后）一律视为不存在
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, MAX_CPUS);
+    __type(key, u32);
+    __type(value, struct cpu_topo);
+} cpu_topo_map SEC(".maps");
+
+/* 在线 CPU 的紧凑列表，便于按序号 O(1) 选核（由用户态加载器在拓扑变化时刷新） */
+struct cpu_lists {
+    u32 nr_online;
+    u32 nr_perf;
+    u32 nr_eff;
+    u32 seq;             // 刷新次数
+    u32 online[MAX_CPUS];
+    u32 perf[MAX_CPUS];
+    u32 eff[MAX_CPUS];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, struct cpu_lists);
+} cpu_lists_map SEC(".maps");
+
+/* 统计计数器（与用户态 sched.c 保持一致） */
+enum sched_stat {
+    STAT_WAKE_AFFINE_SYNC = 0, // 同步唤醒：放到 waker 所在 CPU
+    STAT_WAKE_AFFINE_LLC,      // 放到 waker 所在 LLC 的空闲 CPU
+    STAT_WAKE_AFFINE_FULL,     // 伙伴 LLC 已满，放弃亲和（防止过度堆叠）
+    STAT_WAKE_LLC_HIT,         // 唤醒后 wakee 与 waker 同 LLC
+    STAT_WAKE_LLC_MISS,        // 唤醒后 wakee 与 waker 跨 LLC
+    STAT_STICKY_HOT,           // 缓存热任务留在上次的 CPU
+    STAT_STICKY_OVERLOAD,      // 缓存热但上次的 CPU 过载，允许迁移
+    STAT_CGRP_OVER_SHARE,      // dispatch 时跳过超出公平份额的 cgroup 任务
+    STAT_CGRP_THROTTLED,       // dispatch 时跳过被 cpu.max 限流的 cgroup 任务
+    STAT_PACKED,               // 紧凑放置到已有任务的核心
+    STAT_CPU_ONLINE,           // cpu_online 回调次数
+    STAT_CPU_OFFLINE,          // cpu_offline 回调次数
+    STAT_OFFLINE_REDIRECT,     // 选中的 CPU 已下线，改选其他在线 CPU
+    STAT_LAT_ENQUEUE,          // 延迟类任务入队次数
+    STAT_LAT_DISPATCH,         // 从延迟类 DSQ 分派的次数
+    STAT_LAT_OVER_CAP,         // 延迟类超出利用率上限，让位于卦象队列
+    STAT_LAT_DEADLINE_MISS,    // 延迟类任务在截止时间之后才让出 CPU
+    STAT_DISPATCH_CALLS,       // dispatch 回调次数
+    STAT_DISPATCH_TASKS,       // dispatch 搬运到本地队列的任务数
+    STAT_DISPATCH_EMPTY_PROBE, // 探查到空的卦象 DSQ
+    STAT_DISPATCH_HINT_SKIP,   // 依据本 CPU 的空队列记录跳过探查
+    STAT_DISPATCH_KICK,        // 批量搬运后源队列仍有任务，唤醒空闲 CPU
+    STAT_TASK_CTX_FULL,        // task_ctx_map 插入失败（map 已满），该任务不再定卦
+    STAT_LAT_INELIGIBLE,       // 延迟类任务尚未到可运行时间（超出预留），dispatch 时跳过
+    STAT_MIGRATE_BASE,         // 按卦象统计的迁移次数（8 个连续计数器）
+    NR_STATS = STAT_MIGRATE_BASE + 8,
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, NR_STATS);
+    __type(key, u32);
+    __type(value, u64);
+} stats_map SEC(".maps");
+
+/* 策略方案：时间片、dispatch 顺序、放置偏好与变卦阈值（由加载器写入，可运行时切换） */
+#define NR_GUA 8
+
+enum placement_pref {
+    PLACE_SPREAD = 0,  // 按风水分散到各核心
+    PLACE_PACK   = 1,  // 坤/坎任务集中到尽量少的核心，其余核心进入深度空闲
+};
+
+struct policy_profile {
+    u64 slice_ns[NR_GUA];       // 各卦象时间片（按卦象编号索引），0 表示使用默认值
+    u32 dispatch_order[NR_GUA]; // dispatch 依次检查的 DSQ ID，0 表示结束
+    u32 id;                     // 方案编号（仅用于展示）
+    u32 placement;              // enum placement_pref
+    u32 pack_max_queued;        // 紧凑放置时单个 CPU 本地队列上限
+    u32 reserved;
+    u64 yang_to_yin_ns;         // 乾运行超过该时长转坤
+    u64 yin_to_yang_ns;         // 坤等待超过该时长转乾
+    u64 flip_min_ns;            // 单爻翻转区间下限
+    u64 flip_max_ns;            // 单爻翻转区间上限
+};
+
+/*
+ * 双缓冲：加载器先写非活动槽位，再切换 profile_slot。
+ * BPF 每次只读活动槽位，运行中切换方案不会读到新旧方案混合的字段。
+ */
+#define NR_PROFILE_SLOTS 2
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, NR_PROFILE_SLOTS);
+    __type(key, u32);
+    __type(value, struct policy_profile);
+} profile_map SEC(".maps");
+
+u32 profile_slot;   // 活动槽位，由加载器在写完新方案后切换
+
+/* cgroup 上下文：层级权重与运行时间记账 */
+struct cgrp_ctx {
+    u64 parent_id;        // 父 cgroup id（根为 0）
+    u64 runtime_ns;       // 累计运行时间
+    u64 window_start;     // 公平窗口起点
+    u64 window_usage;     // 本公平窗口内已用 CPU 时间
+    u64 bw_period_ns;     // cpu.max 周期，0 表示不限
+    u64 bw_quota_ns;      // cpu.max 配额，0 表示不限
+    u64 bw_period_start;  // 当前限流周期起点
+    u64 bw_usage;         // 当前限流周期内已用 CPU 时间
+    u64 nr_throttled;     // 进入限流的次数
+    u64 last_active_ns;   // 本 cgroup 或其后代最近一次有任务入队、运行或排队等待的时间
+    u32 weight;           // cpu.weight
+    u32 active_weight_sum;  // 活跃直接子 cgroup 的权重之和（定时器刷新）
+    u32 active_weight_next; // 刷新过程中累加的新值
+    u32 hweight;          // 层级权重，HWEIGHT_ONE 为满额
+    u32 level;            // 层级深度（根为 0）
+    u32 active;           // 上次刷新时是否计入父 cgroup 的 active_weight_sum
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 4096);
+    __type(key, u64);
+    __type(value, struct cgrp_ctx);
+} cgrp_ctx_map SEC(".maps");
+
+/* 周期定时器：限流周期切换后唤醒空闲 CPU 重新 dispatch，并刷新各 DSQ 的健康状态 */
+struct bw_timer {
+    struct bpf_timer timer;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, struct bw_timer);
+} bw_timer_map SEC(".maps");
+
+bool throttle_pending;
+u64 cgrp_refresh_at;    // 上次刷新层级权重的时间
+u32 cgrp_refresh_busy;  // 刷新进行中，防止定时器与 cgroup 回调并发累加
+bool cgrp_refresh_dirty; // 刷新被跳过，下个定时器周期立即补做
+
+/* 延迟类成员（由加载器按配置写入并做准入控制），键为线程 pid */
+struct latency_class {
+    u64 slice_ns;         // 每个周期预留的运行时间，也是截止时间相对可运行时间的偏移
+    u64 period_ns;        // 预留周期：可运行时间按 period/slice 的速率推进（预留速率 slice/period）
+    u64 nr_activations;   // 激活次数
+    u64 nr_misses;        // 截止时间错过次数
+    u64 max_lateness_ns;  // 最大超时
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 1024);
+    __type(key, u32);
+    __type(value, struct latency_class);
+} latency_map SEC(".maps");
+
+/* 各卦象 DSQ 的插入序号（按 DSQ ID 索引），插入后递增 */
+u64 dsq_insert_seq[NR_GUA + 1];
+
+/* 每个 CPU 的 dispatch 提示：上次探查到某 DSQ 为空时它的插入序号 + 1（0 表示无记录） */
+struct dispatch_hint {
+    u64 empty_seq[NR_GUA + 1];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, struct dispatch_hint);
+} dispatch_hint_map SEC(".maps");
+
+/* 退出信息（UEI）：exit 回调记录被卸载的原因，加载器据此报告并决定是否重启 */
+UEI_DEFINE(uei);
+
+/* 健康状态（按 DSQ ID 索引）：供加载器的看门狗读取 */
+#define NR_HEALTH_DSQ 10
+u64 dsq_max_wait_ns[NR_HEALTH_DSQ];   // 上次读取以来出队任务的最大排队时长，加载器原子交换取走并清零
+u64 dsq_head_wait_ns[NR_HEALTH_DSQ];  // 队首任务当前已等待的时长（定时器刷新）
+u32 dsq_queued[NR_HEALTH_DSQ];        // 排队任务数（定时器刷新）
+
+/* 延迟类在当前窗口内已用的 CPU 时间 */
+u64 lat_window_start;
+u64 lat_window_usage;
+
 extern s32 scx_bpf_create_dsq(u64 dsq_id, s32 node) __ksym;
 extern void scx_bpf_destroy_dsq(u64 dsq_id) __ksym;
 extern void scx_bpf_dsq_insert(struct task_struct *p, u64 dsq_id, u64 slice, u64 enq_flags) __ksym;
+extern void scx_bpf_dsq_insert_vtime(struct task_struct *p, u64 dsq_id, u64 slice, u64 vtime, u64 enq_flags) __ksym;
 extern bool scx_bpf_dsq_move_to_local(u64 dsq_id) __ksym;
+extern s32 scx_bpf_select_cpu_dfl(struct task_struct *p, s32 prev_cpu, u64 wake_flags, bool *is_idle) __ksym;
+extern bool scx_bpf_test_and_clear_cpu_idle(s32 cpu) __ksym;
+extern s32 scx_bpf_dsq_nr_queued(u64 dsq_id) __ksym;
+extern bool bpf_cpumask_test_cpu(u32 cpu, const struct cpumask *cpumask) __ksym;
+extern s32 scx_bpf_task_cpu(const struct task_struct *p) __ksym;
+extern void scx_bpf_kick_cpu(s32 cpu, u64 flags) __ksym;
+extern int bpf_iter_scx_dsq_new(struct bpf_iter_scx_dsq *it, u64 dsq_id, u64 flags) __ksym;
+extern struct task_struct *bpf_iter_scx_dsq_next(struct bpf_iter_scx_dsq *it) __ksym;
+extern void bpf_iter_scx_dsq_destroy(struct bpf_iter_scx_dsq *it) __ksym;
+extern bool scx_bpf_dsq_move(struct bpf_iter_scx_dsq *it__iter, struct task_struct *p, u64 dsq_id, u64 enq_flags) __ksym;
+extern struct cgroup *scx_bpf_task_cgroup(struct task_struct *p) __ksym;
+extern void bpf_cgroup_release(struct cgroup *cgrp) __ksym;
+extern const struct cpumask *scx_bpf_get_idle_cpumask(void) __ksym;
+extern void scx_bpf_put_idle_cpumask(const struct cpumask *cpumask) __ksym;
+extern u32 bpf_cpumask_any_distribute(const struct cpumask *cpumask) __ksym;
+extern u32 scx_bpf_nr_cpu_ids(void) __ksym;
+
+// 读取本 CPU 的 preempt_count：6.15 之前位于 pcpu_hot，之后恢复为独立的 per-CPU 变量
+struct pcpu_hot___local {
+    int preempt_count;
+} __attribute__((preserve_access_index));
+extern struct pcpu_hot___local pcpu_hot __ksym __weak;
+extern const int __preempt_count __ksym __weak;
 
 char LICENSE[] SEC("license") = "GPL";
 
@@ -69,6 +329,144 @@ char LICENSE[] SEC("license") = "GPL";
 #define DSQ_LI    6  // 101 离：火
 #define DSQ_XUN   7  // 110 巽：风
 #define DSQ_QIAN  8  // 111 乾：极阳
+#define DSQ_LATENCY 9  // 延迟类：按虚拟截止时间排序
+
+/* 伙伴亲和参数 */
+#define WAKE_AFFINE_MIN_STREAK  2  // 被同一 waker 连续唤醒至少 2 次才视为生产者-消费者伙伴
+#define WAKE_AFFINE_MAX_QUEUED  1  // 目标 CPU 本地队列超过该长度则视为已满，避免过度堆叠
+#define WAKE_AFFINE_STREAK_CAP  64
+
+// preempt_count 中的中断位（include/linux/preempt.h）
+#define SOFTIRQ_MASK  0x0000ff00U
+#define HARDIRQ_MASK  0x000f0000U
+#define NMI_MASK      0x00f00000U
+#define PF_KTHREAD    0x00200000U
+
+/* 缓存热窗口默认参数 */
+#define CACHE_HOT_US_DEFAULT       2000  // 2ms
+#define CACHE_HOT_RSS_SCALE        4     // 三爻为阳（RSS 大）时窗口放大倍数
+#define STICKY_MAX_QUEUED_DEFAULT  2
+
+/* cgroup 公平参数 */
+#define HWEIGHT_ONE          65536       // 层级权重定点数的 1.0
+#define MAX_CGRP_LEVELS      8           // 计算层级权重时最多向上追溯的层数
+#define CGRP_FAIR_WINDOW_NS  100000000ULL // 100ms 公平窗口
+#define BW_TIMER_NS          5000000ULL  // 5ms 限流检查周期
+#define CGRP_IDLE_NS         50000000ULL // 50ms 内无入队/运行/排队的 cgroup 不参与兄弟权重分配
+#define CGRP_REFRESH_NS      20000000ULL // 20ms 刷新一次活跃兄弟权重与层级权重
+#define CGRP_ACTIVE_MARK_NS  1000000ULL  // 1ms 内已标记过活跃则不再重复写
+
+/* 延迟类参数 */
+#define LAT_SLICE_DEFAULT    1000000ULL   // 1ms
+#define LAT_PERIOD_DEFAULT   10000000ULL  // 10ms
+#define LAT_CAP_PCT_DEFAULT  25
+#define LAT_WINDOW_NS        100000000ULL // 100ms 利用率窗口
+
+/* 批量 dispatch 参数 */
+#define DISPATCH_BATCH_DEFAULT      4
+/*
+ * 一批任务数的上限由本文件自行限制：ops.dispatch_max_batch 只约束 dispatch 中 scx_bpf_dsq_insert
+ * 的缓冲，对 scx_bpf_dsq_move/scx_bpf_dsq_move_to_local 不起作用。上限取 32，
+ * 使一批搬运在最短时间片（1ms）下也不会让本地队列积压超过几十毫秒。
+ */
+#define DISPATCH_BATCH_MAX          32
+#define DISPATCH_BUDGET_US_DEFAULT  5000   // 5ms
+
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 1
+#endif
+
+enum cgrp_state {
+    CGRP_OK = 0,         // 在公平份额内
+    CGRP_OVER_SHARE,     // 超出公平份额，仅在无其他任务时运行
+    CGRP_THROTTLED,      // 超出 cpu.max 配额，本周期内不运行
+};
+
+static __always_inline void stat_inc(u32 idx)
+{
+    u64 *cnt = bpf_map_lookup_elem(&stats_map, &idx);
+    if (cnt)
+        (*cnt)++;
+}
+
+static __always_inline void stat_add(u32 idx, u64 val)
+{
+    u64 *cnt = bpf_map_lookup_elem(&stats_map, &idx);
+    if (cnt)
+        *cnt += val;
+}
+
+static __always_inline struct policy_profile *get_profile(void)
+{
+    u32 key = *(volatile u32 *)&profile_slot & (NR_PROFILE_SLOTS - 1);
+    return bpf_map_lookup_elem(&profile_map, &key);
+}
+
+static __always_inline struct task_ctx *get_task_ctx(u32 pid)
+{
+    struct task_ctx *tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+    if (!tctx) {
+        struct task_ctx init = {};
+        bpf_map_update_elem(&task_ctx_map, &pid, &init, BPF_NOEXIST);
+        tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+        if (!tctx)
+            stat_inc(STAT_TASK_CTX_FULL);
+    }
+    return tctx;
+}
+
+static __always_inline u32 cpu_llc_id(s32 cpu)
+{
+    u32 key = cpu;
+    struct cpu_topo *topo = bpf_map_lookup_elem(&cpu_topo_map, &key);
+    return topo ? topo->llc_id : 0;
+}
+
+static __always_inline bool cpu_is_online(s32 cpu)
+{
+    u32 key = cpu;
+    struct cpu_topo *topo = bpf_map_lookup_elem(&cpu_topo_map, &key);
+    return topo && topo->present && !topo->offline;
+}
+
+static __always_inline bool cpu_is_perf(s32 cpu)
+{
+    u32 key = cpu;
+    struct cpu_topo *topo = bpf_map_lookup_elem(&cpu_topo_map, &key);
+    return topo && topo->is_perf;
+}
+
+static __always_inline struct cpu_lists *get_cpu_lists(void)
+{
+    u32 key = 0;
+    struct cpu_lists *lists = bpf_map_lookup_elem(&cpu_lists_map, &key);
+    return lists && lists->nr_online > 0 ? lists : NULL;
+}
+
+/* 若 cpu 已下线（或越界），顺序寻找下一个在线 CPU */
+static __always_inline s32 pick_online_cpu(s32 cpu)
+{
+    u32 key = 0;
+    struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &key);
+    u32 num_cpus = config && config->num_cpus > 0 ? config->num_cpus : 8;
+    u32 i;
+
+    if (cpu < 0 || cpu >= num_cpus)
+        cpu = 0;
+    if (cpu_is_online(cpu))
+        return cpu;
+
+    stat_inc(STAT_OFFLINE_REDIRECT);
+    for (i = 1; i < MAX_CPUS; i++) {
+        u32 c = (cpu + i) % num_cpus;
+
+        if (i >= num_cpus)
+            break;
+        if (cpu_is_online(c))
+            return c;
+    }
+    return bpf_get_smp_processor_id();
+}
 
 /*
 	定卦算法：根据进程的行为特征计算八卦类型（gua_type）。每个维度对应一个爻，三维度组合成八卦。
@@ -152,20 +550,36 @@ static __always_inline u32 calculate_task_gua(struct task_struct *p, struct task
     震卦（雷）任务：分配到离中断源最近的核心，追求极致响应。
     离卦（火）任务：分配到散热条件最好（当前温度最低）的核心。
 */
-static __always_inline s32 select_cpu_by_fengshui(u32 pid, u32 gua) {
+static __always_inline s32 select_cpu_by_fengshui(u32 pid, u32 gua, s32 task_cpu) {
     s32 selected_cpu = -1;
 
-    /* 从系统配置map中获取实际CPU数量 */
+    /* 在线 CPU 列表由加载器维护；尚未写入时退化为按编号取模 */
+    struct cpu_lists *lists = get_cpu_lists();
     u32 key = 0;
     struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &key);
     u32 num_cpus = 8; // 默认8个CPU
-    u32 num_perf_cpus = 4; // 默认性能核心
+    u32 nr_online, nr_perf, nr_eff;
     
-    if (config) {
+    if (config)
         num_cpus = config->num_cpus > 0 ? config->num_cpus : 8;
-        num_perf_cpus = config->num_perf_cpus > 0 ? config->num_perf_cpus : (num_cpus / 2);
+
+    if (lists) {
+        nr_online = lists->nr_online;
+        nr_perf = lists->nr_perf > 0 ? lists->nr_perf : nr_online;
+        nr_eff = lists->nr_eff;
+    } else {
+        nr_online = num_cpus;
+        nr_perf = config && config->num_perf_cpus > 0 ? config->num_perf_cpus : (num_cpus / 2);
+        nr_eff = num_cpus > nr_perf ? num_cpus - nr_perf : 0;
+        if (nr_perf == 0)
+            nr_perf = 1;
     }
 
+/* 第 n 个在线性能核心 / 能效核心 / 在线核心 */
+#define PERF_CPU(n)   (lists && lists->nr_perf ? (s32)lists->perf[(n) % nr_perf & (MAX_CPUS - 1)] : (s32)((n) % nr_perf))
+#define EFF_CPU(n)    (lists ? (s32)lists->eff[(n) % nr_eff & (MAX_CPUS - 1)] : (s32)(nr_perf + (n) % nr_eff))
+#define ONLINE_CPU(n) (lists ? (s32)lists->online[(n) % nr_online & (MAX_CPUS - 1)] : (s32)((n) % nr_online))
+
     /* 获取当前 CPU，用作基准 */
     s32 current_cpu = bpf_get_smp_processor_id();
     if (current_cpu < 0) current_cpu = 0;
@@ -173,65 +587,63 @@ static __always_inline s32 select_cpu_by_fengshui(u32 pid, u32 gua) {
     switch (gua) {
         case GUA_QIAN:
             /* 乾卦（纯阳 111）：天位 - 优先调度到高频核心 */
-            /* 倾向于性能核心（前num_perf_cpus个核心） */
-            selected_cpu = pid % num_perf_cpus;
+            /* 倾向于在线的性能核心 */
+            selected_cpu = PERF_CPU(pid);
             break;
             
         case GUA_KUN:
             /* 坤卦（纯阴 000）：地位 - 调度到能效核心 */
-            /* 倾向于能效核心（后面的核心），减少竞争 */
-            if (num_cpus > num_perf_cpus) {
-                u32 eff_cpu_count = num_cpus - num_perf_cpus;
-                selected_cpu = num_perf_cpus + (pid % eff_cpu_count);
+            /* 倾向于在线的能效核心，减少竞争 */
+            if (nr_eff > 0) {
+                selected_cpu = EFF_CPU(pid);
             } else {
-                selected_cpu = pid % num_cpus;
+                selected_cpu = ONLINE_CPU(pid);
             }
             break;
             
         case GUA_ZHEN:
             /* 震卦（雷 001）：追求响应性 - 保持在当前核心附近 */
             /* 优先在性能核心中保持亲和性 */
-            if (current_cpu < num_perf_cpus) {
+            if (lists ? cpu_is_perf(current_cpu) : current_cpu < nr_perf) {
                 selected_cpu = current_cpu;  // 保持在当前性能核心
             } else {
-                selected_cpu = pid % num_perf_cpus;  // 迁移到性能核心
+                selected_cpu = PERF_CPU(pid);  // 迁移到性能核心
             }
             break;
             
         case GUA_LI:
             /* 离卦（火 101）：需要散热 - 选择相对空闲的核心 */
             /* 分散到不同核心以降低热密度 */
-            selected_cpu = (pid + current_cpu) % num_cpus;
+            selected_cpu = ONLINE_CPU(pid + current_cpu);
             break;
             
         case GUA_XUN:
-            /* 巽卦（风 110）：灵活流动 - 选择相邻核心 */
-            selected_cpu = (current_cpu + 1) % num_cpus;
+            /* 巽卦（风 110）：灵活流动 - 选择相邻核心（下一个在线核心） */
+            selected_cpu = pick_online_cpu((current_cpu + 1) % num_cpus);
             break;
             
         case GUA_KAN:
             /* 坎卦（水 010）：流动特性 - 允许跨核运行 */
             /* IO密集型任务，倾向于能效核心 */
-            if (num_cpus > num_perf_cpus) {
-                u32 eff_cpu_count = num_cpus - num_perf_cpus;
-                selected_cpu = num_perf_cpus + ((pid ^ current_cpu) % eff_cpu_count);
+            if (nr_eff > 0) {
+                selected_cpu = EFF_CPU(pid ^ current_cpu);
             } else {
-                selected_cpu = (pid ^ current_cpu) % num_cpus;
+                selected_cpu = ONLINE_CPU(pid ^ current_cpu);
             }
             break;
             
         case GUA_GEN:
-            /* 艮卦（山 100）：稳定特性 - 黏着在当前核心 */
-            selected_cpu = current_cpu;
+            /* 艮卦（山 100）：稳定特性 - 黏着在任务自己上次运行的核心 */
+            selected_cpu = task_cpu >= 0 ? task_cpu : current_cpu;
             break;
             
         case GUA_DUI:
             /* 兑卦（泽 011）：交互特性 - 选择邻近核心 */
             /* 优先在性能核心中进行交互 */
-            if (current_cpu < num_perf_cpus) {
-                selected_cpu = (current_cpu + 1) % num_perf_cpus;
+            if (lists ? cpu_is_perf(current_cpu) : current_cpu < nr_perf) {
+                selected_cpu = PERF_CPU(current_cpu + 1);
             } else {
-                selected_cpu = pid % num_perf_cpus;
+                selected_cpu = PERF_CPU(pid);
             }
             break;
             
@@ -239,7 +651,12 @@ static __always_inline s32 select_cpu_by_fengshui(u32 pid, u32 gua) {
             selected_cpu = current_cpu;
     }
 
-    return selected_cpu >= 0 ? selected_cpu : current_cpu;
+#undef PERF_CPU
+#undef EFF_CPU
+#undef ONLINE_CPU
+
+    /* 列表可能尚未随热插拔刷新：只返回在线 CPU */
+    return pick_online_cpu(selected_cpu >= 0 ? selected_cpu : current_cpu);
 }
 
 /* 将卦象映射到五行元素 */
@@ -295,23 +712,36 @@ bool is_conflict(u32 task_element, u32 cpu_element) {
 */
 static __always_inline u32 handle_bian_gua(struct task_struct *p, struct task_ctx *tctx, u64 elapsed_ns) {
     u32 current_gua = tctx->current_gua;
+    struct policy_profile *prof = get_profile();
+    u64 yang_to_yin_ns = 50000000ULL;
+    u64 yin_to_yang_ns = 100000000ULL;
+    u64 flip_min_ns = 10000000ULL;
+    u64 flip_max_ns = 50000000ULL;
+
+    /* 阈值由当前策略方案决定 */
+    if (prof && prof->yang_to_yin_ns) {
+        yang_to_yin_ns = prof->yang_to_yin_ns;
+        yin_to_yang_ns = prof->yin_to_yang_ns;
+        flip_min_ns = prof->flip_min_ns;
+        flip_max_ns = prof->flip_max_ns;
+    }
     
-    /* 阳极生阴：运行时间过长（超过 50ms）的纯阳任务应转为阴卦 */
-    if (current_gua == GUA_QIAN && elapsed_ns > 50000000ULL) {
+    /* 阳极生阴：运行时间过长（默认超过 50ms）的纯阳任务应转为阴卦 */
+    if (current_gua == GUA_QIAN && elapsed_ns > yang_to_yin_ns) {
         /* 乾(111) -> 坤(000)，翻转所有爻 */
         tctx->current_gua = GUA_KUN;
         return GUA_KUN;
     }
     
     /* 阴极生阳：在队列中等待过久的纯阴任务应转为阳卦，提升执行机会 */
-    if (current_gua == GUA_KUN && elapsed_ns > 100000000ULL) {
+    if (current_gua == GUA_KUN && elapsed_ns > yin_to_yang_ns) {
         /* 坤(000) -> 乾(111)，翻转所有爻 */
         tctx->current_gua = GUA_QIAN;
         return GUA_QIAN;
     }
     
-    /* 单爻翻转：运行时间中等(10-50ms)的多爻卦象，翻转最低位（初爻） */
-    if (elapsed_ns > 10000000ULL && elapsed_ns <= 50000000ULL) {
+    /* 单爻翻转：运行时间中等(默认 10-50ms)的多爻卦象，翻转最低位（初爻） */
+    if (elapsed_ns > flip_min_ns && elapsed_ns <= flip_max_ns) {
         if (current_gua != GUA_QIAN && current_gua != GUA_KUN) {
             u32 new_gua = current_gua ^ 1;  /* 翻转最低位 */
             tctx->current_gua = new_gua;
@@ -323,87 +753,793 @@ static __always_inline u32 handle_bian_gua(struct task_struct *p, struct task_ct
     return current_gua;
 }
 
-SEC("struct_ops.s/init")
-s32 sched_init(void)
+/*
+	安土重迁算法：迁移有代价，缓存仍热的任务应留在原处。
+	任务停止运行后的一段时间内（缓存热窗口），其数据仍驻留在上次 CPU 的缓存中：
+    窗口按三爻（RSS 空间足迹）缩放：足迹大的任务重新预热代价更高，窗口放大。
+    窗口内被唤醒时留在上次的 CPU；若该 CPU 本地队列积压超过阈值，则宁可迁移也不排队。
+*/
+static __always_inline bool task_is_cache_hot(struct task_ctx *tctx, u64 now)
 {
-    /* 创建八卦DSQ */
-    if (scx_bpf_create_dsq(DSQ_KUN, -1))
-        return -1;
-    if (scx_bpf_create_dsq(DSQ_ZHEN, -1))
-        return -1;
-    if (scx_bpf_create_dsq(DSQ_KAN, -1))
-        return -1;
-    if (scx_bpf_create_dsq(DSQ_DUI, -1))
-        return -1;
-    if (scx_bpf_create_dsq(DSQ_GEN, -1))
-        return -1;
-    if (scx_bpf_create_dsq(DSQ_LI, -1))
+    u32 key = 0;
+    struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &key);
+    u64 window_ns = CACHE_HOT_US_DEFAULT;
+
+    if (tctx->last_ran_at == 0)
+        return false;
+
+    if (config && config->cache_hot_us > 0)
+        window_ns = config->cache_hot_us;
+    window_ns *= 1000;
+
+    /* 三爻为阳：内存足迹大 */
+    if (tctx->current_gua & 4)
+        window_ns *= CACHE_HOT_RSS_SCALE;
+
+    return now - tctx->last_ran_at < window_ns;
+}
+
+static __always_inline s32 select_cpu_by_stickiness(struct task_struct *p, struct task_ctx *tctx, s32 prev_cpu)
+{
+    u32 key = 0;
+    struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &key);
+    s32 max_queued = STICKY_MAX_QUEUED_DEFAULT;
+
+    if (prev_cpu < 0 || !task_is_cache_hot(tctx, bpf_ktime_get_ns()) ||
+        !bpf_cpumask_test_cpu(prev_cpu, p->cpus_ptr))
         return -1;
-    if (scx_bpf_create_dsq(DSQ_XUN, -1))
+
+    // 加载器总在 attach 前写入配置，0 是合法值（只在本地队列为空时留下）
+    if (config)
+        max_queued = config->sticky_max_queued;
+
+    if (scx_bpf_dsq_nr_queued(SCX_DSQ_LOCAL_ON | prev_cpu) > max_queued) {
+        stat_inc(STAT_STICKY_OVERLOAD);
         return -1;
-    if (scx_bpf_create_dsq(DSQ_QIAN, -1))
+    }
+
+    stat_inc(STAT_STICKY_HOT);
+    return prev_cpu;
+}
+
+/*
+	藏器于身算法（省电方案）：坤/坎这类阴柔任务不需要散开，集中到尽量少的核心上。
+    按在线列表先扫能效核心、再扫性能核心，寻找本地队列未满的核心，使其余核心长期空闲、进入深度 C-state。
+    只在唤醒选核（select_cpu）时生效；非唤醒入队仍进入卦象队列，由 dispatch 统一调度。
+*/
+static __always_inline s32 select_cpu_packed(struct task_struct *p, u32 gua)
+{
+    struct policy_profile *prof = get_profile();
+    struct cpu_lists *lists = get_cpu_lists();
+    u32 key = 0;
+    struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &key);
+    u32 num_cpus = 8, nr_eff = 0, nr_total, i;
+    s32 max_queued;
+
+    if (!prof || prof->placement != PLACE_PACK || (gua != GUA_KUN && gua != GUA_KAN))
         return -1;
-	return 0;
+
+    if (config)
+        num_cpus = config->num_cpus > 0 ? config->num_cpus : 8;
+    max_queued = prof->pack_max_queued > 0 ? prof->pack_max_queued : 2;
+
+    /*
+     * 按加载器维护的在线列表扫描：先能效核心（eff[]），再性能核心（perf[]），两者合起来即全部在线 CPU。
+     * 性能/能效核心按容量识别，编号不一定连续；列表尚未写入时退化为按编号扫描。
+     */
+    if (lists) {
+        nr_eff = lists->nr_eff;
+        nr_total = nr_eff + lists->nr_perf;
+    } else {
+        nr_total = num_cpus;
+    }
+
+    for (i = 0; i < MAX_CPUS; i++) {
+        u32 cpu;
+
+        if (i >= nr_total)
+            break;
+        if (!lists)
+            cpu = i;
+        else if (i < nr_eff)
+            cpu = lists->eff[i & (MAX_CPUS - 1)];
+        else
+            cpu = lists->perf[(i - nr_eff) & (MAX_CPUS - 1)];
+        if (cpu >= MAX_CPUS || !cpu_is_online(cpu) || !bpf_cpumask_test_cpu(cpu, p->cpus_ptr))
+            continue;
+        if (scx_bpf_dsq_nr_queued(SCX_DSQ_LOCAL_ON | cpu) < max_queued) {
+            stat_inc(STAT_PACKED);
+            return cpu;
+        }
+    }
+    return -1;
 }
 
-SEC("struct_ops.s/exit")
-s32 BPF_PROG(sched_exit, struct scx_exit_info *ei)
+/*
+	同气相求算法：记录"谁唤醒了谁"，让生产者-消费者（管道/套接字两端）落在同一缓存域。
+	《易经·乾·文言》："同声相应，同气相求"。频繁相互唤醒的两个任务共享数据，应当靠近：
+    同步唤醒（waker 即将睡眠）：直接放到 waker 所在的 CPU，数据仍在 L1/L2 中。
+    普通唤醒：在 waker 所在 LLC 中寻找空闲 CPU（优先 wakee 上次所在的 CPU）。
+    过犹不及：目标 CPU 的本地队列已有积压、或 LLC 内无空闲 CPU 时放弃亲和，交还默认选核。
+    只有任务上下文中的唤醒才代表真实的伙伴关系：中断里的 current 只是恰好被打断的任务，
+    idle 与内核线程也不是生产者，这些唤醒既不记录也不按伙伴选核。
+*/
+static __always_inline bool bpf_in_interrupt(void)
 {
-	(void)ei;
-    /* 销毁八卦DSQ */
-    scx_bpf_destroy_dsq(DSQ_KUN);
-    scx_bpf_destroy_dsq(DSQ_ZHEN);
-    scx_bpf_destroy_dsq(DSQ_KAN);
-    scx_bpf_destroy_dsq(DSQ_DUI);
-    scx_bpf_destroy_dsq(DSQ_GEN);
-    scx_bpf_destroy_dsq(DSQ_LI);
-    scx_bpf_destroy_dsq(DSQ_XUN);
-    scx_bpf_destroy_dsq(DSQ_QIAN);
-	return 0;
+    int pc;
+
+    if (bpf_ksym_exists(&pcpu_hot))
+        pc = ((struct pcpu_hot___local *)bpf_this_cpu_ptr(&pcpu_hot))->preempt_count;
+    else if (bpf_ksym_exists(&__preempt_count))
+        pc = *(const int *)bpf_this_cpu_ptr(&__preempt_count);
+    else
+        return false;
+    return pc & (NMI_MASK | HARDIRQ_MASK | SOFTIRQ_MASK);
 }
 
-SEC("struct_ops/enqueue")
-s32 BPF_PROG(enqueue, struct task_struct *p, u64 enq_flags)
+static __always_inline bool waker_is_partner_candidate(u32 waker_pid, u32 wakee_pid)
+{
+    struct task_struct *cur;
+
+    if (waker_pid == 0 || waker_pid == wakee_pid || bpf_in_interrupt())
+        return false;
+    cur = bpf_get_current_task_btf();
+    return !(cur->flags & PF_KTHREAD);
+}
+
+static __always_inline void record_waker(struct task_ctx *tctx, u32 waker_pid, s32 waker_cpu)
+{
+    if (tctx->partner_pid == waker_pid) {
+        if (tctx->partner_streak < WAKE_AFFINE_STREAK_CAP)
+            tctx->partner_streak++;
+    } else {
+        tctx->partner_pid = waker_pid;
+        tctx->partner_streak = 1;
+    }
+    tctx->waker_cpu = waker_cpu;
+}
+
+static __always_inline s32 select_cpu_by_partner(struct task_struct *p, struct task_ctx *tctx,
+                                                 s32 prev_cpu, u64 wake_flags)
+{
+    s32 waker_cpu = tctx->waker_cpu;
+    u32 waker_llc, i;
+
+    if (tctx->partner_streak < WAKE_AFFINE_MIN_STREAK)
+        return -1;
+
+    /* 同步唤醒：waker 即将让出 CPU，wakee 紧随其后运行 */
+    if ((wake_flags & SCX_WAKE_SYNC) &&
+        bpf_cpumask_test_cpu(waker_cpu, p->cpus_ptr) &&
+        scx_bpf_dsq_nr_queued(SCX_DSQ_LOCAL_ON | waker_cpu) < WAKE_AFFINE_MAX_QUEUED) {
+        stat_inc(STAT_WAKE_AFFINE_SYNC);
+        return waker_cpu;
+    }
+
+    /* 同 LLC 内优先回到 wakee 上次运行的 CPU */
+    waker_llc = cpu_llc_id(waker_cpu);
+    if (prev_cpu >= 0 && cpu_llc_id(prev_cpu) == waker_llc &&
+        bpf_cpumask_test_cpu(prev_cpu, p->cpus_ptr) &&
+        scx_bpf_test_and_clear_cpu_idle(prev_cpu)) {
+        stat_inc(STAT_WAKE_AFFINE_LLC);
+        return prev_cpu;
+    }
+
+    u32 key = 0;
+    struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &key);
+    u32 num_cpus = config && config->num_cpus > 0 ? config->num_cpus : 8;
+
+    for (i = 0; i < MAX_CPUS; i++) {
+        if (i >= num_cpus)
+            break;
+        if (cpu_llc_id(i) != waker_llc || !cpu_is_online(i) ||
+            !bpf_cpumask_test_cpu(i, p->cpus_ptr))
+            continue;
+        if (scx_bpf_test_and_clear_cpu_idle(i)) {
+            stat_inc(STAT_WAKE_AFFINE_LLC);
+            return i;
+        }
+    }
+
+    /* 伙伴所在缓存域没有余量，不再往里塞 */
+    stat_inc(STAT_WAKE_AFFINE_FULL);
+    return -1;
+}
+
+SEC("struct_ops/select_cpu")
+s32 BPF_PROG(select_cpu, struct task_struct *p, s32 prev_cpu, u64 wake_flags)
 {
     u32 pid = BPF_CORE_READ(p, pid);
-    struct task_ctx *tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
-    if (!tctx) {
-        struct task_ctx init = {};
-        bpf_map_update_elem(&task_ctx_map, &pid, &init, BPF_NOEXIST);
-        tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+    u32 waker_pid = (u32)bpf_get_current_pid_tgid();
+    s32 waker_cpu = bpf_get_smp_processor_id();
+    struct task_ctx *tctx = get_task_ctx(pid);
+    bool is_idle = false;
+    s32 cpu;
+
+    if (tctx && waker_is_partner_candidate(waker_pid, pid)) {
+        record_waker(tctx, waker_pid, waker_cpu);
+        cpu = select_cpu_by_partner(p, tctx, prev_cpu, wake_flags);
+        if (cpu >= 0) {
+            tctx->place_local = 1;
+            goto out;
+        }
     }
+
+    /* 缓存仍热：留在上次运行的 CPU */
     if (tctx) {
-        u64 now = bpf_ktime_get_ns();
-        u64 elapsed_ns = 0;
-        
-        /* 记录入队时间 */
-        if (tctx->enqueue_time == 0) {
-            tctx->enqueue_time = now;
-        } else {
-            elapsed_ns = now - tctx->enqueue_time;
+        cpu = select_cpu_by_stickiness(p, tctx, prev_cpu);
+        if (cpu >= 0) {
+            tctx->place_local = 1;
+            goto out;
         }
-        
-        /* 第一步：定卦 - 实时观测进程特征，计算卦象 */
-        u32 gua = calculate_task_gua(p, tctx);
-        
-        /* 第二步：变卦 - 根据运行/等待时长调整卦象（处理状态衰老） */
-        gua = handle_bian_gua(p, tctx, elapsed_ns);
-        tctx->current_gua = gua;
-        
-        /* 第三步：映射到五行元素 */
-        u32 task_element = gua_to_xingwu(gua);
-        tctx->current_element = task_element;
-        
-        /* 第四步：寻龙点穴 - 根据卦象选择最优 CPU */
-        s32 selected_cpu = select_cpu_by_fengshui(pid, gua);
-        if (selected_cpu >= 0) {
-            tctx->assigned_cpu = selected_cpu;
+    }
+
+    /* 省电方案：阴柔任务集中到少数核心，不去唤醒空闲核心 */
+    if (tctx) {
+        cpu = select_cpu_packed(p, tctx->current_gua);
+        if (cpu >= 0) {
+            tctx->place_local = 1;
+            goto out;
+        }
+    }
+
+    /* 其余唤醒：沿用内核默认选核，任务仍经 enqueue 定卦后入卦象队列 */
+    cpu = scx_bpf_select_cpu_dfl(p, prev_cpu, wake_flags, &is_idle);
+
+out:
+    if (tctx && waker_pid != 0 && waker_pid != pid) {
+        if (cpu_llc_id(cpu) == cpu_llc_id(waker_cpu))
+            stat_inc(STAT_WAKE_LLC_HIT);
+        else
+            stat_inc(STAT_WAKE_LLC_MISS);
+    }
+    return cpu;
+}
+
+/*
+	分封建国算法：多租户之间按 cgroup 层级权重分配 CPU，位于卦象优先级之上。
+	天子分封诸侯，诸侯再分封大夫：每个 cgroup 的份额 = 父份额 × 自身权重 / 活跃兄弟权重之和。
+    只有近期有任务入队、运行或在队列中等待的 cgroup 才算活跃；空闲的兄弟不占份额，
+    否则 systemd 下几十个空闲 slice 会把每个容器的份额摊薄到 1% 左右，cpu.weight 形同虚设。
+    活跃标记沿层级向上传递；定时器每 CGRP_REFRESH_NS 汇总一次活跃兄弟权重并重算全部层级权重，
+    cgroup 退出或改权重时立即重算，兄弟的份额随之更新；新建的 cgroup 尚不活跃，只算自身份额。
+    公平窗口内，已用时间超出层级份额的 cgroup，其任务（无论何种卦象）让位于未超额 cgroup 的任务；
+    若其他 cgroup 都无任务可运行，仍允许其运行（工作守恒）。
+    开启 cpu.max 限流时，本周期配额用尽的 cgroup 直到下个周期都不会被 dispatch。
+*/
+static __always_inline bool cgrp_is_active(struct cgrp_ctx *cgc, u64 now)
+{
+    return cgc->last_active_ns + CGRP_IDLE_NS > now;
+}
+
+/* 标记 cgroup 及其祖先活跃；祖先的时间戳不早于后代，遇到近期已标记的即可停止 */
+static __always_inline void cgrp_mark_active(u64 cgid, u64 now)
+{
+    u32 i;
+
+    for (i = 0; i < MAX_CGRP_LEVELS; i++) {
+        struct cgrp_ctx *cgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgid);
+
+        if (!cgc || cgc->last_active_ns + CGRP_ACTIVE_MARK_NS > now)
+            break;
+        cgc->last_active_ns = now;
+        if (cgc->level == 0)
+            break;
+        cgid = cgc->parent_id;
+    }
+}
+
+static __always_inline u32 cgrp_hweight(u64 cgid)
+{
+    u64 hweight = HWEIGHT_ONE;
+    u32 i;
+
+    for (i = 0; i < MAX_CGRP_LEVELS; i++) {
+        struct cgrp_ctx *cgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgid);
+        struct cgrp_ctx *pcgc;
+        u32 sum;
+
+        if (!cgc || cgc->level == 0)
+            break;
+        pcgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgc->parent_id);
+        if (!pcgc)
+            break;
+        /* 自身未计入活跃兄弟时按"即将加入"计算，份额不会超过满额 */
+        sum = pcgc->active_weight_sum + (cgc->active ? 0 : cgc->weight);
+        if (sum > 0)
+            hweight = hweight * cgc->weight / sum;
+        cgid = cgc->parent_id;
+    }
+
+    return hweight > 0 ? hweight : 1;
+}
+
+static long cgrp_reset_active_cb(struct bpf_map *map, u64 *cgid, struct cgrp_ctx *cgc, void *ctx)
+{
+    cgc->active_weight_next = 0;
+    return 0;
+}
+
+static long cgrp_sum_active_cb(struct bpf_map *map, u64 *cgid, struct cgrp_ctx *cgc, u64 *now)
+{
+    struct cgrp_ctx *pcgc;
+
+    cgc->active = cgc->level > 0 && cgrp_is_active(cgc, *now);
+    if (!cgc->active)
+        return 0;
+    pcgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgc->parent_id);
+    if (pcgc)
+        __sync_fetch_and_add(&pcgc->active_weight_next, cgc->weight);
+    else
+        cgc->active = 0;
+    return 0;
+}
+
+static long cgrp_publish_active_cb(struct bpf_map *map, u64 *cgid, struct cgrp_ctx *cgc, void *ctx)
+{
+    cgc->active_weight_sum = cgc->active_weight_next;
+    return 0;
+}
+
+static long cgrp_update_hweight_cb(struct bpf_map *map, u64 *cgid, struct cgrp_ctx *cgc, void *ctx)
+{
+    cgc->hweight = cgrp_hweight(*cgid);
+    return 0;
+}
+
+/* 汇总活跃兄弟权重并重算所有 cgroup 的层级权重；与其他刷新并发时留给下个定时器周期 */
+static __always_inline void cgrp_refresh_hweights(u64 now)
+{
+    if (__sync_val_compare_and_swap(&cgrp_refresh_busy, 0, 1) != 0) {
+        cgrp_refresh_dirty = true;
+        return;
+    }
+    cgrp_refresh_dirty = false;
+    cgrp_refresh_at = now;
+
+    bpf_for_each_map_elem(&cgrp_ctx_map, cgrp_reset_active_cb, NULL, 0);
+    bpf_for_each_map_elem(&cgrp_ctx_map, cgrp_sum_active_cb, &now, 0);
+    bpf_for_each_map_elem(&cgrp_ctx_map, cgrp_publish_active_cb, NULL, 0);
+    bpf_for_each_map_elem(&cgrp_ctx_map, cgrp_update_hweight_cb, NULL, 0);
+
+    __sync_lock_test_and_set(&cgrp_refresh_busy, 0);
+}
+
+static __always_inline void cgrp_charge(u64 cgid, u64 used, u64 now)
+{
+    struct cgrp_ctx *cgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgid);
+
+    if (!cgc)
+        return;
+
+    __sync_fetch_and_add(&cgc->runtime_ns, used);
+    cgrp_mark_active(cgid, now);
+
+    if (now - cgc->window_start >= CGRP_FAIR_WINDOW_NS) {
+        cgc->window_start = now;
+        cgc->window_usage = 0;
+    }
+    __sync_fetch_and_add(&cgc->window_usage, used);
+
+    if (cgc->bw_quota_ns > 0) {
+        if (now - cgc->bw_period_start >= cgc->bw_period_ns) {
+            cgc->bw_period_start = now;
+            cgc->bw_usage = 0;
+        }
+        if (cgc->bw_usage < cgc->bw_quota_ns && cgc->bw_usage + used >= cgc->bw_quota_ns)
+            cgc->nr_throttled++;
+        __sync_fetch_and_add(&cgc->bw_usage, used);
+    }
+}
+
+/* 任务所属 cgroup 以 tctx->cgrp_id 为准（首次入队时取自 scx_bpf_task_cgroup，之后由 cgroup_move 更新） */
+static __always_inline u32 cgrp_task_state(u64 cgid, u64 now)
+{
+    struct cgrp_ctx *cgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgid);
+    u32 key = 0;
+    struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &key);
+    u32 num_cpus = 8;
+    u64 share;
+
+    if (!cgc || cgc->level == 0)
+        return CGRP_OK;
+
+    if (config) {
+        num_cpus = config->num_cpus > 0 ? config->num_cpus : 8;
+        if (config->cgroup_bw && cgc->bw_quota_ns > 0 &&
+            now - cgc->bw_period_start < cgc->bw_period_ns &&
+            cgc->bw_usage >= cgc->bw_quota_ns)
+            return CGRP_THROTTLED;
+    }
+
+    /* 窗口已过期，视为尚未用量 */
+    if (now - cgc->window_start >= CGRP_FAIR_WINDOW_NS)
+        return CGRP_OK;
+
+    share = CGRP_FAIR_WINDOW_NS * num_cpus / HWEIGHT_ONE * cgc->hweight;
+    return cgc->window_usage > share ? CGRP_OVER_SHARE : CGRP_OK;
+}
+
+/* 记录各 DSQ 的排队数与队首任务已等待的时长（延迟类按截止时间排序，队首不一定等待最久） */
+static __always_inline void refresh_dsq_health(u64 now)
+{
+    struct bpf_iter_scx_dsq it;
+    struct task_struct *p;
+    u32 dsq_id;
+
+    for (dsq_id = DSQ_KUN; dsq_id <= DSQ_LATENCY; dsq_id++) {
+        s32 nr = scx_bpf_dsq_nr_queued(dsq_id);
+        u64 wait = 0;
+
+        dsq_queued[dsq_id] = nr > 0 ? nr : 0;
+        if (nr > 0) {
+            bpf_iter_scx_dsq_new(&it, dsq_id, 0);
+            p = bpf_iter_scx_dsq_next(&it);
+            if (p) {
+                u32 pid = p->pid;
+                struct task_ctx *tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+
+                if (tctx && tctx->enqueue_time && now > tctx->enqueue_time)
+                    wait = now - tctx->enqueue_time;
+            }
+            bpf_iter_scx_dsq_destroy(&it);
+        }
+        dsq_head_wait_ns[dsq_id] = wait;
+    }
+}
+
+static int bw_timer_fn(void *map, int *key, struct bpf_timer *timer)
+{
+    u32 cfg_key = 0;
+    struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &cfg_key);
+    u32 num_cpus = config && config->num_cpus > 0 ? config->num_cpus : 8;
+    u64 now;
+    u32 i;
+
+    (void)map;
+    (void)key;
+
+    /* 有任务因限流被跳过：新周期开始后唤醒空闲 CPU 重新拉取 */
+    if (throttle_pending) {
+        throttle_pending = false;
+        for (i = 0; i < MAX_CPUS; i++) {
+            if (i >= num_cpus)
+                break;
+            if (cpu_is_online(i))
+                scx_bpf_kick_cpu(i, SCX_KICK_IDLE);
+        }
+    }
+
+    now = bpf_ktime_get_ns();
+    refresh_dsq_health(now);
+    if (cgrp_refresh_dirty || now - cgrp_refresh_at >= CGRP_REFRESH_NS)
+        cgrp_refresh_hweights(now);
+
+    bpf_timer_start(timer, BW_TIMER_NS, 0);
+    return 0;
+}
+
+SEC("struct_ops.s/cgroup_init")
+s32 BPF_PROG(cgroup_init, struct cgroup *cgrp, struct scx_cgroup_init_args *args)
+{
+    u64 cgid = BPF_CORE_READ(cgrp, kn, id);
+    struct cgrp_ctx init = {
+        .weight = args->weight,
+        .level = BPF_CORE_READ(cgrp, level),
+    };
+    struct cgrp_ctx *pcgc;
+
+    if (init.level > 0)
+        init.parent_id = BPF_CORE_READ(cgrp, self.parent, cgroup, kn, id);
+
+#ifdef HAVE_CGROUP_BW
+    /* cpu.max 为 "max" 时配额为 U64_MAX，视为不限；早于 6.17 的内核没有这两个字段 */
+    if (bpf_core_field_exists(args->bw_quota_us) &&
+        args->bw_quota_us != (u64)-1 && args->bw_period_us > 0) {
+        init.bw_quota_ns = args->bw_quota_us * 1000;
+        init.bw_period_ns = args->bw_period_us * 1000;
+    }
+#endif
+
+    if (bpf_map_update_elem(&cgrp_ctx_map, &cgid, &init, BPF_ANY))
+        return -12; /* -ENOMEM */
+
+    /* 新 cgroup 尚无任务，不影响兄弟的活跃权重之和，只需算出自身份额 */
+    pcgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgid);
+    if (pcgc)
+        pcgc->hweight = cgrp_hweight(cgid);
+    return 0;
+}
+
+SEC("struct_ops.s/cgroup_exit")
+s32 BPF_PROG(cgroup_exit, struct cgroup *cgrp)
+{
+    u64 cgid = BPF_CORE_READ(cgrp, kn, id);
+    struct cgrp_ctx *cgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgid);
+    bool counted;
+
+    if (!cgc)
+        return 0;
+
+    counted = cgc->active;
+    bpf_map_delete_elem(&cgrp_ctx_map, &cgid);
+    /* 计入过父 cgroup 活跃权重的 cgroup 退出后，兄弟的份额随之变化，全部重算 */
+    if (counted)
+        cgrp_refresh_hweights(bpf_ktime_get_ns());
+    return 0;
+}
+
+SEC("struct_ops/cgroup_set_weight")
+s32 BPF_PROG(cgroup_set_weight, struct cgroup *cgrp, u32 weight)
+{
+    u64 cgid = BPF_CORE_READ(cgrp, kn, id);
+    struct cgrp_ctx *cgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgid);
+
+    if (!cgc)
+        return 0;
+
+    cgc->weight = weight;
+    /* 自身与兄弟的份额都随之变化 */
+    cgrp_refresh_hweights(bpf_ktime_get_ns());
+    return 0;
+}
+
+#ifdef HAVE_CGROUP_BW
+SEC("struct_ops/cgroup_set_bandwidth")
+s32 BPF_PROG(cgroup_set_bandwidth, struct cgroup *cgrp, u64 period_us, u64 quota_us, u64 burst_us)
+{
+    u64 cgid = BPF_CORE_READ(cgrp, kn, id);
+    struct cgrp_ctx *cgc = bpf_map_lookup_elem(&cgrp_ctx_map, &cgid);
+
+    (void)burst_us;
+    if (!cgc)
+        return 0;
+
+    if (quota_us != (u64)-1 && period_us > 0) {
+        cgc->bw_quota_ns = quota_us * 1000;
+        cgc->bw_period_ns = period_us * 1000;
+    } else {
+        cgc->bw_quota_ns = 0;
+        cgc->bw_period_ns = 0;
+    }
+    cgc->bw_period_start = 0;
+    cgc->bw_usage = 0;
+    return 0;
+}
+#endif /* HAVE_CGROUP_BW */
+
+SEC("struct_ops/cgroup_move")
+s32 BPF_PROG(cgroup_move, struct task_struct *p, struct cgroup *from, struct cgroup *to)
+{
+    u32 pid = BPF_CORE_READ(p, pid);
+    struct task_ctx *tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+
+    (void)from;
+    if (tctx)
+        tctx->cgrp_id = BPF_CORE_READ(to, kn, id);
+    return 0;
+}
+
+/*
+	刻漏算法：为有明确响应时间要求的任务（音频、行情线程）提供截止时间调度，位于卦象优先级之上。
+	刻漏计时，过时不候：成员向加载器申报每周期所需的运行时间（slice）与周期（period），
+    加载器做准入控制，保证所有成员的 slice/period 之和不超过利用率上限。
+    入队时可运行时间取"当前时间"与"按预留速率折算的已用时间"中较晚者，虚拟截止时间 = 可运行时间 + slice（EEVDF），
+    按截止时间在 vtime DSQ 中排序，先于卦象队列分派；超出预留的成员截止时间后移，不会挤占其他成员，
+    且可运行时间未到前 dispatch 不分派它，不会挤占卦象队列。
+    运行时再以窗口用量兜底：窗口内延迟类用量超过上限时退到卦象队列之后。
+*/
+static __always_inline bool lat_under_cap(u64 now)
+{
+    u32 key = 0;
+    struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &key);
+    u64 cap_pct = LAT_CAP_PCT_DEFAULT, nr_cpus = 8;
+
+    if (config) {
+        if (config->latency_cap_pct > 0)
+            cap_pct = config->latency_cap_pct;
+        if (config->num_perf_cpus + config->num_eff_cpus > 0)
+            nr_cpus = config->num_perf_cpus + config->num_eff_cpus;
+        else if (config->num_cpus > 0)
+            nr_cpus = config->num_cpus;
+    }
+
+    /* 窗口已过期，视为尚未用量 */
+    if (now - lat_window_start >= LAT_WINDOW_NS)
+        return true;
+    return lat_window_usage * 100 < LAT_WINDOW_NS * nr_cpus * cap_pct;
+}
+
+static __always_inline void lat_charge(u64 used, u64 now)
+{
+    if (now - lat_window_start >= LAT_WINDOW_NS) {
+        lat_window_start = now;
+        lat_window_usage = 0;
+    }
+    __sync_fetch_and_add(&lat_window_usage, used);
+}
+
+static __always_inline void lat_enqueue(struct task_struct *p, struct task_ctx *tctx,
+                                        struct latency_class *lc, u64 now, u64 enq_flags)
+{
+    u64 slice = lc->slice_ns ? lc->slice_ns : LAT_SLICE_DEFAULT;
+
+    if (tctx->lat_eligible < now)
+        tctx->lat_eligible = now;
+
+    /* 唤醒即一次新的激活：记下截止时间，完成（睡眠）时检查是否错过 */
+    if ((enq_flags & SCX_ENQ_WAKEUP) || tctx->lat_deadline == 0) {
+        tctx->lat_deadline = tctx->lat_eligible + slice;
+        __sync_fetch_and_add(&lc->nr_activations, 1);
+    }
+
+    stat_inc(STAT_LAT_ENQUEUE);
+    scx_bpf_dsq_insert_vtime(p, DSQ_LATENCY, slice, tctx->lat_eligible + slice, enq_flags);
+}
+
+/* 任务让出 CPU：按预留速率推进可运行时间，完成时检查截止时间 */
+static __always_inline void lat_stopping(struct task_ctx *tctx, struct latency_class *lc,
+                                         bool runnable, u64 now)
+{
+    u64 slice = lc->slice_ns ? lc->slice_ns : LAT_SLICE_DEFAULT;
+    u64 period = lc->period_ns ? lc->period_ns : LAT_PERIOD_DEFAULT;
+    u64 used = 0;
+
+    if (tctx->running_at != 0 && now > tctx->running_at)
+        used = now - tctx->running_at;
+    lat_charge(used, now);
+    tctx->lat_eligible += used * period / slice;
+
+    if (runnable || tctx->lat_deadline == 0)
+        return;
+
+    if (now > tctx->lat_deadline) {
+        u64 lateness = now - tctx->lat_deadline;
+
+        __sync_fetch_and_add(&lc->nr_misses, 1);
+        if (lateness > lc->max_lateness_ns)
+            lc->max_lateness_ns = lateness;
+        stat_inc(STAT_LAT_DEADLINE_MISS);
+    }
+    tctx->lat_deadline = 0;
+}
+
+/*
+ * 按截止时间顺序取第一个已到可运行时间的成员。超出预留的成员可运行时间在将来，
+ * 跳过它们，让卦象队列先运行，使每个成员被限制在申报的 slice/period 之内；
+ * any 为真时（卦象队列都为空）不检查可运行时间，保持工作守恒。
+ */
+static __always_inline bool dispatch_latency(u64 now, bool any)
+{
+    struct bpf_iter_scx_dsq it;
+    struct task_struct *p;
+    bool moved = false;
+
+    if (any) {
+        moved = scx_bpf_dsq_move_to_local(DSQ_LATENCY);
+    } else {
+        bpf_iter_scx_dsq_new(&it, DSQ_LATENCY, 0);
+        while ((p = bpf_iter_scx_dsq_next(&it))) {
+            u32 pid = p->pid;
+            struct task_ctx *tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+
+            if (tctx && tctx->lat_eligible > now) {
+                stat_inc(STAT_LAT_INELIGIBLE);
+                continue;
+            }
+            if (scx_bpf_dsq_move(&it, p, SCX_DSQ_LOCAL, 0)) {
+                moved = true;
+                break;
+            }
+        }
+        bpf_iter_scx_dsq_destroy(&it);
+    }
+
+    if (!moved)
+        return false;
+    stat_inc(STAT_LAT_DISPATCH);
+    stat_inc(STAT_DISPATCH_TASKS);
+    return true;
+}
+
+SEC("struct_ops.s/init")
+s32 sched_init(void)
+{
+    /* 创建八卦DSQ */
+    if (scx_bpf_create_dsq(DSQ_KUN, -1))
+        return -1;
+    if (scx_bpf_create_dsq(DSQ_ZHEN, -1))
+        return -1;
+    if (scx_bpf_create_dsq(DSQ_KAN, -1))
+        return -1;
+    if (scx_bpf_create_dsq(DSQ_DUI, -1))
+        return -1;
+    if (scx_bpf_create_dsq(DSQ_GEN, -1))
+        return -1;
+    if (scx_bpf_create_dsq(DSQ_LI, -1))
+        return -1;
+    if (scx_bpf_create_dsq(DSQ_XUN, -1))
+        return -1;
+    if (scx_bpf_create_dsq(DSQ_QIAN, -1))
+        return -1;
+    if (scx_bpf_create_dsq(DSQ_LATENCY, -1))
+        return -1;
+
+    /* 启动限流周期定时器 */
+    u32 key = 0;
+    struct bw_timer *t = bpf_map_lookup_elem(&bw_timer_map, &key);
+    if (!t)
+        return -1;
+    bpf_timer_init(&t->timer, &bw_timer_map, CLOCK_MONOTONIC);
+    bpf_timer_set_callback(&t->timer, bw_timer_fn);
+    if (bpf_timer_start(&t->timer, BW_TIMER_NS, 0))
+        return -1;
+	return 0;
+}
+
+SEC("struct_ops.s/exit")
+s32 BPF_PROG(sched_exit, struct scx_exit_info *ei)
+{
+    UEI_RECORD(uei, ei);
+
+    /* 销毁八卦DSQ */
+    scx_bpf_destroy_dsq(DSQ_KUN);
+    scx_bpf_destroy_dsq(DSQ_ZHEN);
+    scx_bpf_destroy_dsq(DSQ_KAN);
+    scx_bpf_destroy_dsq(DSQ_DUI);
+    scx_bpf_destroy_dsq(DSQ_GEN);
+    scx_bpf_destroy_dsq(DSQ_LI);
+    scx_bpf_destroy_dsq(DSQ_XUN);
+    scx_bpf_destroy_dsq(DSQ_QIAN);
+    scx_bpf_destroy_dsq(DSQ_LATENCY);
+	return 0;
+}
+
+SEC("struct_ops/enqueue")
+s32 BPF_PROG(enqueue, struct task_struct *p, u64 enq_flags)
+{
+    u32 pid = BPF_CORE_READ(p, pid);
+    struct task_ctx *tctx = get_task_ctx(pid);
+    if (tctx) {
+        u64 now = bpf_ktime_get_ns();
+        u64 elapsed_ns = 0;
+
+        /* 与 cgroup_init/cgroup_move 使用同一个 cgroup（cpu 控制器所在层级），而非 dfl_cgrp 叶子 */
+        if (tctx->cgrp_id == 0) {
+            struct cgroup *cgrp = scx_bpf_task_cgroup(p);
+
+            tctx->cgrp_id = BPF_CORE_READ(cgrp, kn, id);
+            bpf_cgroup_release(cgrp);
         }
         
-        /* 第五步：五行相克检查 - 避免资源冲突 */
-        /* 注：在实际应用中可以根据当前 CPU 上的任务进行冲突检查 */
-        /* 这里我们的策略是使用冲突检查优化队列分配 */
-        
+        /* 记录入队时间 */
+        if (tctx->enqueue_time == 0) {
+            tctx->enqueue_time = now;
+        } else {
+            elapsed_ns = now - tctx->enqueue_time;
+        }
+        
+        /* 第一步：定卦 - 实时观测进程特征，计算卦象 */
+        u32 gua = calculate_task_gua(p, tctx);
+        
+        /* 第二步：变卦 - 根据运行/等待时长调整卦象（处理状态衰老） */
+        gua = handle_bian_gua(p, tctx, elapsed_ns);
+        tctx->current_gua = gua;
+        
+        /* 第三步：映射到五行元素 */
+        u32 task_element = gua_to_xingwu(gua);
+        tctx->current_element = task_element;
+        
+        /* 第四步：寻龙点穴 - 根据卦象选择最优 CPU */
+        s32 selected_cpu = select_cpu_by_fengshui(pid, gua, scx_bpf_task_cpu(p));
+        if (selected_cpu >= 0) {
+            tctx->assigned_cpu = selected_cpu;
+        }
+        
+        /* 第五步：五行相克检查 - 避免资源冲突 */
+        /* 注：在实际应用中可以根据当前 CPU 上的任务进行冲突检查 */
+        /* 这里我们的策略是使用冲突检查优化队列分配 */
+        
         /* 第六步：根据卦象和分析结果选择分发策略 */
         u64 time_slice = slice_normal;  /* 默认时间片 */
         u64 dsq_id = SCX_DSQ_GLOBAL;     /* 默认全局队列 */
@@ -497,8 +1633,48 @@ s32 BPF_PROG(enqueue, struct task_struct *p, u64 enq_flags)
                 time_slice = slice_normal;
         }
         
+        /* 时间片由当前策略方案决定 */
+        struct policy_profile *prof = get_profile();
+        if (prof && prof->slice_ns[gua & 7])
+            time_slice = prof->slice_ns[gua & 7];
+
+        /*
+         * 分封建国：直接放入本地队列或延迟类队列的任务不经过 dispatch 的 cgroup 检查，
+         * 限流中的 cgroup 一律进入卦象队列，超出公平份额的 cgroup 也不直接占用本地队列。
+         */
+        cgrp_mark_active(tctx->cgrp_id, now);
+        u32 cgrp_state = cgrp_task_state(tctx->cgrp_id, now);
+
+        /* 刻漏：延迟类成员按虚拟截止时间入队，不走卦象队列 */
+        struct latency_class *lc = bpf_map_lookup_elem(&latency_map, &pid);
+        if (lc && cgrp_state != CGRP_THROTTLED) {
+            lat_enqueue(p, tctx, lc, now, enq_flags);
+            tctx->last_dsq = DSQ_LATENCY;
+            tctx->place_local = 0;
+            tctx->enqueue_time = now;
+            return 0;
+        }
+
+        /*
+         * 同气相求/安土重迁/藏器于身：select_cpu 已选好 CPU，直接放入该 CPU 的本地队列。
+         * 非唤醒入队（时间片用完、被抢占）一律进入卦象队列，保留 dispatch 的优先级、批量与限流。
+         */
+        if (cgrp_state == CGRP_OK && (enq_flags & SCX_ENQ_WAKEUP) && tctx->place_local) {
+            dsq_id = SCX_DSQ_LOCAL;
+            tctx->assigned_cpu = scx_bpf_task_cpu(p);
+        }
+        tctx->place_local = 0;
+
         /* 执行队列插入 */
         scx_bpf_dsq_insert(p, dsq_id, time_slice, enq_flags);
+
+        /* 插入之后再递增序号，使各 CPU 的空队列记录失效 */
+        if (dsq_id >= DSQ_KUN && dsq_id <= DSQ_QIAN) {
+            __sync_fetch_and_add(&dsq_insert_seq[dsq_id], 1);
+            tctx->last_dsq = dsq_id;
+        } else {
+            tctx->last_dsq = 0;
+        }
         
         /* 重置入队时间，准备下一周期 */
         tctx->enqueue_time = now;
@@ -507,6 +1683,267 @@ s32 BPF_PROG(enqueue, struct task_struct *p, u64 enq_flags)
 	return 0;
 }
 
+/* 任务退出或离开 sched_ext：删除其上下文，避免 task_ctx_map 被已退出的 pid 占满 */
+SEC("struct_ops/exit_task")
+s32 BPF_PROG(exit_task, struct task_struct *p, struct scx_exit_task_args *args)
+{
+    u32 pid = BPF_CORE_READ(p, pid);
+
+    (void)args;
+    bpf_map_delete_elem(&task_ctx_map, &pid);
+    bpf_map_delete_elem(&latency_map, &pid);
+    return 0;
+}
+
+/*
+	CPU 热插拔：实现 cpu_online/cpu_offline 后，vCPU 增减不会使调度器被内核卸载。
+    回调即时更新 cpu_topo_map 中的在线标志，选核只会返回在线 CPU；
+    下线 CPU 本地队列中的任务由内核迁出，之后插入其本地队列的任务会回落到全局队列。
+    紧凑列表与性能/能效划分由加载器检测到拓扑变化后重建。
+*/
+SEC("struct_ops/cpu_online")
+s32 BPF_PROG(cpu_online, s32 cpu)
+{
+    u32 key = cpu;
+    struct cpu_topo *topo = bpf_map_lookup_elem(&cpu_topo_map, &key);
+
+    if (topo) {
+        topo->present = 1;
+        topo->offline = 0;
+    }
+    stat_inc(STAT_CPU_ONLINE);
+    return 0;
+}
+
+SEC("struct_ops/cpu_offline")
+s32 BPF_PROG(cpu_offline, s32 cpu)
+{
+    u32 key = cpu;
+    struct cpu_topo *topo = bpf_map_lookup_elem(&cpu_topo_map, &key);
+
+    if (topo)
+        topo->offline = 1;
+    stat_inc(STAT_CPU_OFFLINE);
+    return 0;
+}
+
+SEC("struct_ops/running")
+s32 BPF_PROG(running, struct task_struct *p)
+{
+    u32 pid = BPF_CORE_READ(p, pid);
+    struct task_ctx *tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+    u32 cpu = scx_bpf_task_cpu(p);
+
+    if (!tctx)
+        return 0;
+
+    /* 记录迁移：上次运行过且换了 CPU */
+    if (tctx->last_ran_at != 0 && tctx->last_cpu != cpu) {
+        tctx->migrations++;
+        stat_inc(STAT_MIGRATE_BASE + (tctx->current_gua & 7));
+    }
+    tctx->last_cpu = cpu;
+    tctx->running_at = bpf_ktime_get_ns();
+
+    /* 看门狗：记录各 DSQ 出队任务的最大排队时长（各 CPU 并发更新，用 CAS 避免丢失较大值） */
+    if (tctx->last_dsq > 0 && tctx->last_dsq < NR_HEALTH_DSQ &&
+        tctx->enqueue_time && tctx->running_at > tctx->enqueue_time) {
+        u64 wait = tctx->running_at - tctx->enqueue_time;
+        u64 *max_wait = &dsq_max_wait_ns[tctx->last_dsq];
+        u64 old;
+        u32 i;
+
+        for (i = 0; i < 4; i++) {
+            old = *(volatile u64 *)max_wait;
+            if (wait <= old || __sync_val_compare_and_swap(max_wait, old, wait) == old)
+                break;
+        }
+    }
+    tctx->last_dsq = 0;
+    return 0;
+}
+
+SEC("struct_ops/stopping")
+s32 BPF_PROG(stopping, struct task_struct *p, bool runnable)
+{
+    u32 pid = BPF_CORE_READ(p, pid);
+    struct task_ctx *tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+    struct latency_class *lc;
+
+    u64 now = bpf_ktime_get_ns();
+
+    if (!tctx)
+        return 0;
+
+    /* 将本次运行时间记入所属 cgroup */
+    if (tctx->running_at != 0 && now > tctx->running_at)
+        cgrp_charge(tctx->cgrp_id, now - tctx->running_at, now);
+
+    lc = bpf_map_lookup_elem(&latency_map, &pid);
+    if (lc)
+        lat_stopping(tctx, lc, runnable, now);
+    tctx->last_ran_at = now;
+    return 0;
+}
+
+/*
+	批量分派：每次 dispatch 从优先级最高的非空卦象 DSQ 连续搬运多个任务到本地队列，减少 dispatch 回调次数。
+    一批最多 dispatch_batch 个任务，且时间片总和不超过预算，后到的高优先级任务至多等待一个预算。
+    一批都搬到本 CPU 后源队列若仍有任务，唤醒一个空闲 CPU 来拉取，避免任务积压在本 CPU 而兄弟 CPU 空闲。
+*/
+struct dispatch_budget {
+    u32 nr_left;     // 本批还可搬运的任务数
+    u64 slice_left;  // 本批剩余的时间片预算（ns）
+};
+
+static __always_inline void dispatch_budget_init(struct dispatch_budget *b)
+{
+    u32 key = 0;
+    struct sys_config *config = bpf_map_lookup_elem(&sys_config_map, &key);
+    u32 batch = DISPATCH_BATCH_DEFAULT;
+    u64 budget_us = DISPATCH_BUDGET_US_DEFAULT;
+
+    if (config) {
+        if (config->dispatch_batch > 0)
+            batch = config->dispatch_batch;
+        if (config->dispatch_budget_us > 0)
+            budget_us = config->dispatch_budget_us;
+    }
+
+    b->nr_left = batch < DISPATCH_BATCH_MAX ? batch : DISPATCH_BATCH_MAX;
+    b->slice_left = budget_us * 1000;
+}
+
+/*
+ * 唤醒任意一个空闲 CPU，让它在自己的 dispatch 中拉取。
+ * 没有空闲 CPU 时 bpf_cpumask_any_distribute 返回 nr_cpu_ids，不能交给 scx_bpf_kick_cpu
+ * （非法 CPU 会触发 scx_error 使调度器被卸载）。
+ */
+static __always_inline void kick_idle_cpu(void)
+{
+    const struct cpumask *idle = scx_bpf_get_idle_cpumask();
+    u32 cpu = bpf_cpumask_any_distribute(idle);
+
+    scx_bpf_put_idle_cpumask(idle);
+    if (cpu >= scx_bpf_nr_cpu_ids() || cpu >= MAX_CPUS)
+        return;
+    if (cpu_is_online(cpu)) {
+        scx_bpf_kick_cpu(cpu, SCX_KICK_IDLE);
+        stat_inc(STAT_DISPATCH_KICK);
+    }
+}
+
+/*
+ * 从一个卦象 DSQ 中按批搬运 cgroup 允许运行的任务；strict 时还要求未超出公平份额。
+ * 被跳过的任务留在原处，继续向后查找，避免排在限流任务之后的其他 cgroup 任务被饿住
+ * （迭代器只遍历开始时已在队列中的任务，扫描长度以队列长度为界）。
+ */
+static __always_inline bool dispatch_from_dsq(u64 dsq_id, bool strict, u64 now, struct dispatch_budget *b)
+{
+    struct bpf_iter_scx_dsq it;
+    struct task_struct *p;
+    u32 moved = 0;
+
+    bpf_iter_scx_dsq_new(&it, dsq_id, 0);
+    while ((p = bpf_iter_scx_dsq_next(&it))) {
+        u32 pid = p->pid;
+        struct task_ctx *tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+        u64 slice;
+
+        /* 仍在排队等待的任务也让所属 cgroup 保持活跃 */
+        if (tctx)
+            cgrp_mark_active(tctx->cgrp_id, now);
+
+        switch (cgrp_task_state(tctx ? tctx->cgrp_id : 0, now)) {
+            case CGRP_THROTTLED:
+                stat_inc(STAT_CGRP_THROTTLED);
+                throttle_pending = true;
+                continue;
+            case CGRP_OVER_SHARE:
+                if (strict) {
+                    stat_inc(STAT_CGRP_OVER_SHARE);
+                    continue;
+                }
+                break;
+            default:
+                break;
+        }
+
+        slice = BPF_CORE_READ(p, scx.slice);
+        if (!scx_bpf_dsq_move(&it, p, SCX_DSQ_LOCAL, 0))
+            continue;
+
+        moved++;
+        /* 批次数或时间片预算用尽即停止 */
+        if (--b->nr_left == 0 || slice >= b->slice_left)
+            break;
+        b->slice_left -= slice;
+    }
+    bpf_iter_scx_dsq_destroy(&it);
+
+    if (moved) {
+        stat_add(STAT_DISPATCH_TASKS, moved);
+        if (moved > 1 && scx_bpf_dsq_nr_queued(dsq_id) > 0)
+            kick_idle_cpu();
+    }
+    return moved > 0;
+}
+
+/*
+ * 默认分派优先级：
+ * 1. 乾卦(极阳) - 高性能任务
+ * 2. 离卦(火) - 高运算强度任务
+ * 3. 震卦/兑卦(雷/泽) - 交互式任务
+ * 4. 巽卦(风) - 灵活适应型任务
+ * 5. 艮卦(山) - 稳定型任务
+ * 6. 坎卦(水) - IO密集型任务
+ * 7. 坤卦(极阴) - 能效型任务，最后分派以避免饥荒
+ */
+static const u32 default_dispatch_order[NR_GUA] = {
+    DSQ_QIAN, DSQ_LI, DSQ_ZHEN, DSQ_DUI, DSQ_XUN, DSQ_GEN, DSQ_KAN, DSQ_KUN,
+};
+
+/*
+ * 按策略方案的卦象优先级依次从各 DSQ 分派，只从第一个有任务可搬的 DSQ 取一批。
+ * 本 CPU 上次探查某 DSQ 为空后若它没有新的插入，则不再探查（插入序号先读后探查，
+ * enqueue 先插入后递增序号，因此不会漏掉探查之后插入的任务）。
+ */
+static __always_inline bool dispatch_by_gua_order(bool strict, u64 now, struct dispatch_budget *b)
+{
+    struct policy_profile *prof = get_profile();
+    u32 key = 0;
+    struct dispatch_hint *hint = bpf_map_lookup_elem(&dispatch_hint_map, &key);
+    u32 i;
+
+    for (i = 0; i < NR_GUA; i++) {
+        u32 dsq_id = default_dispatch_order[i];
+        u64 seq;
+
+        if (prof && prof->dispatch_order[0])
+            dsq_id = prof->dispatch_order[i];
+        if (dsq_id == 0)
+            break;
+        if (dsq_id > NR_GUA)
+            continue;
+
+        seq = *(volatile u64 *)&dsq_insert_seq[dsq_id];
+        if (hint && hint->empty_seq[dsq_id] == seq + 1) {
+            stat_inc(STAT_DISPATCH_HINT_SKIP);
+            continue;
+        }
+        if (scx_bpf_dsq_nr_queued(dsq_id) == 0) {
+            if (hint)
+                hint->empty_seq[dsq_id] = seq + 1;
+            stat_inc(STAT_DISPATCH_EMPTY_PROBE);
+            continue;
+        }
+
+        if (dispatch_from_dsq(dsq_id, strict, now, b))
+            return true;
+    }
+    return false;
+}
+
 SEC("struct_ops/dispatch")
 s32 BPF_PROG(dispatch, s32 cpu, struct task_struct *prev)
 {
@@ -521,52 +1958,104 @@ s32 BPF_PROG(dispatch, s32 cpu, struct task_struct *prev)
      * 4. 全局队列由内核自动处理
      */
     
-    /* 优先级1：乾卦(极阳) - 高性能任务 */
-    if (scx_bpf_dsq_move_to_local(DSQ_QIAN)) {
-        return 0;
-    }
-    
-    /* 优先级2：离卦(火) - 高运算强度任务 */
-    if (scx_bpf_dsq_move_to_local(DSQ_LI)) {
-        return 0;
-    }
-    
-    /* 优先级3：震卦/兑卦(雷/泽) - 交互式任务 */
-    if (scx_bpf_dsq_move_to_local(DSQ_ZHEN)) {
-        return 0;
+    u64 now = bpf_ktime_get_ns();
+    struct dispatch_budget b;
+
+    stat_inc(STAT_DISPATCH_CALLS);
+
+    /* 刻漏：利用率上限内，延迟类按截止时间最先分派（逐个分派，保持截止时间顺序） */
+    if (lat_under_cap(now)) {
+        if (dispatch_latency(now, false))
+            return 0;
+    } else if (scx_bpf_dsq_nr_queued(DSQ_LATENCY) > 0) {
+        stat_inc(STAT_LAT_OVER_CAP);
     }
-    if (scx_bpf_dsq_move_to_local(DSQ_DUI)) {
+
+    dispatch_budget_init(&b);
+
+    /* 先只分派未超出公平份额的 cgroup 的任务 */
+    if (dispatch_by_gua_order(true, now, &b))
         return 0;
-    }
-    
-    /* 优先级4：巽卦(风) - 灵活适应型任务 */
-    if (scx_bpf_dsq_move_to_local(DSQ_XUN)) {
+
+    /* 工作守恒：其他 cgroup 都无任务时，超额（但未限流）的 cgroup 也可运行 */
+    if (dispatch_by_gua_order(false, now, &b))
         return 0;
-    }
-    
-    /* 优先级5：艮卦(山) - 稳定型任务 */
-    if (scx_bpf_dsq_move_to_local(DSQ_GEN)) {
+
+    /* 卦象队列都为空：超出上限或尚未到可运行时间的延迟类任务也可运行 */
+    if (dispatch_latency(now, true))
         return 0;
-    }
-    
-    /* 优先级6：坎卦(水) - IO密集型任务 */
-    if (scx_bpf_dsq_move_to_local(DSQ_KAN)) {
+
+    /* 所有DSQ都为空，内核会从 SCX_DSQ_GLOBAL 中自动获取任务 */
+	return 0;
+}
+
+/*
+	观象：遍历所有任务，把 task_ctx 与内核侧的 comm、tgid、cgroup、运行时间、上下文切换次数
+	和 RSS 拼成定长记录，写入 seq_file。用户态只需对迭代器 fd 循环 read，无需逐任务系统调用。
+*/
+SEC("iter/task")
+int dump_task_snapshot(struct bpf_iter__task *ctx)
+{
+    struct seq_file *seq = ctx->meta->seq;
+    struct task_struct *task = ctx->task;
+    struct task_snapshot rec = {};
+    struct task_ctx *tctx;
+    struct mm_struct *mm;
+    u32 pid;
+
+    if (!task)
         return 0;
-    }
-    
-    /* 优先级7：坤卦(极阴) - 能效型任务，最后分派以避免饥荒 */
-    if (scx_bpf_dsq_move_to_local(DSQ_KUN)) {
+
+    /* 只输出由本调度器管理过的任务 */
+    pid = task->pid;
+    tctx = bpf_map_lookup_elem(&task_ctx_map, &pid);
+    if (!tctx)
         return 0;
+
+    rec.pid = pid;
+    rec.tgid = task->tgid;
+    bpf_probe_read_kernel_str(rec.comm, sizeof(rec.comm), task->comm);
+    rec.cgrp_id = tctx->cgrp_id;
+    rec.sum_exec_runtime = task->se.sum_exec_runtime;
+    rec.nvcsw = task->nvcsw;
+    rec.nivcsw = task->nivcsw;
+
+    mm = task->mm;
+    if (mm) {
+        rec.rss_pages = BPF_CORE_READ(mm, rss_stat[MM_FILEPAGES].count) +
+                        BPF_CORE_READ(mm, rss_stat[MM_ANONPAGES].count) +
+                        BPF_CORE_READ(mm, rss_stat[MM_SHMEMPAGES].count);
     }
-    
-    /* 所有DSQ都为空，内核会从 SCX_DSQ_GLOBAL 中自动获取任务 */
-	return 0;
+
+    rec.enqueue_time = tctx->enqueue_time;
+    rec.current_gua = tctx->current_gua;
+    rec.assigned_cpu = tctx->assigned_cpu;
+    rec.current_element = tctx->current_element;
+    rec.last_cpu = tctx->last_cpu;
+    rec.migrations = tctx->migrations;
+    rec.partner_pid = tctx->partner_pid;
+
+    bpf_seq_write(seq, &rec, sizeof(rec));
+    return 0;
 }
 
 SEC(".struct_ops")
 struct sched_ext_ops ops = {
+	.select_cpu = (s32 (*)(struct task_struct *, s32, u64))select_cpu,
 	.enqueue = (void (*)(struct task_struct *, u64))enqueue,
 	.dispatch = (void (*)(s32, struct task_struct *))dispatch,
+	.running = (void (*)(struct task_struct *))running,
+	.stopping = (void (*)(struct task_struct *, bool))stopping,
+	.exit_task = (void (*)(struct task_struct *, struct scx_exit_task_args *))exit_task,
+	.cpu_online = (void (*)(s32))cpu_online,
+	.cpu_offline = (void (*)(s32))cpu_offline,
+	.cgroup_init = (s32 (*)(struct cgroup *, struct scx_cgroup_init_args *))cgroup_init,
+	.cgroup_exit = (void (*)(struct cgroup *))cgroup_exit,
+	.cgroup_move = (void (*)(struct task_struct *, struct cgroup *, struct cgroup *))cgroup_move,
+	.cgroup_set_weight = (void (*)(struct cgroup *, u32))cgroup_set_weight,
+#ifdef HAVE_CGROUP_BW
+	.cgroup_set_bandwidth = (void (*)(struct cgroup *, u64, u64, u64))cgroup_set_bandwidth,
+#endif
 	.init = sched_init,
 	.exit = (void (*)(struct scx_exit_info *))sched_exit,
 	.name = "fengshui",
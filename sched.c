@@ -1,44 +1,291 @@
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <ftw.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
 
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
+#include <bpf/btf.h>
 
+#include "user_exit_info.h"
 #include "sched.skel.h"
+#include "snapshot.h"
 
 /* 系统配置结构体（与BPF代码保持一致） */
 struct sys_config {
 	uint32_t num_cpus;      /* CPU总数 */
 	uint32_t num_perf_cpus; /* 性能核心数 */
 	uint32_t num_eff_cpus;  /* 能效核心数 */
-	uint32_t reserved[5];   /* 预留字段 */
+	uint32_t cache_hot_us;      /* 缓存热窗口（微秒） */
+	uint32_t sticky_max_queued; /* 上次 CPU 过载阈值（本地队列长度，0 表示只粘空队列） */
+	uint32_t cgroup_bw;         /* 非零时按 cpu.max 对 cgroup 限流 */
+	uint32_t latency_cap_pct;   /* 延迟类利用率上限（百分比） */
+	uint32_t dispatch_batch;    /* 每次 dispatch 最多搬运的任务数 */
+	uint32_t dispatch_budget_us; /* 一批任务的时间片总和上限（微秒） */
+	uint32_t reserved[2];   /* 预留字段 */
+};
+
+
+#define MAX_CPUS 256
+
+/* 与 BPF 中的 cpu_topo 对齐 */
+struct cpu_topo {
+	uint32_t llc_id;
+	uint32_t offline;
+	uint32_t is_perf;
+	uint32_t present;
+};
+
+/* 与 BPF 中的 cpu_lists 对齐 */
+struct cpu_lists {
+	uint32_t nr_online;
+	uint32_t nr_perf;
+	uint32_t nr_eff;
+	uint32_t seq;
+	uint32_t online[MAX_CPUS];
+	uint32_t perf[MAX_CPUS];
+	uint32_t eff[MAX_CPUS];
 };
 
-/* 与 BPF 中的 task_ctx 对齐 */
-struct task_ctx {
-	uint64_t last_vruntime;
-	uint64_t last_run_timestamp;
-	uint32_t last_nvcsw;
-	uint32_t current_gua;
-	uint64_t enqueue_time;
-	uint32_t assigned_cpu;
-	uint32_t current_element;
+/* 与 BPF 中的 enum sched_stat 对齐 */
+enum sched_stat {
+	STAT_WAKE_AFFINE_SYNC = 0,
+	STAT_WAKE_AFFINE_LLC,
+	STAT_WAKE_AFFINE_FULL,
+	STAT_WAKE_LLC_HIT,
+	STAT_WAKE_LLC_MISS,
+	STAT_STICKY_HOT,
+	STAT_STICKY_OVERLOAD,
+	STAT_CGRP_OVER_SHARE,
+	STAT_CGRP_THROTTLED,
+	STAT_PACKED,
+	STAT_CPU_ONLINE,
+	STAT_CPU_OFFLINE,
+	STAT_OFFLINE_REDIRECT,
+	STAT_LAT_ENQUEUE,
+	STAT_LAT_DISPATCH,
+	STAT_LAT_OVER_CAP,
+	STAT_LAT_DEADLINE_MISS,
+	STAT_DISPATCH_CALLS,
+	STAT_DISPATCH_TASKS,
+	STAT_DISPATCH_EMPTY_PROBE,
+	STAT_DISPATCH_HINT_SKIP,
+	STAT_DISPATCH_KICK,
+	STAT_TASK_CTX_FULL,
+	STAT_LAT_INELIGIBLE,
+	STAT_MIGRATE_BASE,
+	NR_STATS = STAT_MIGRATE_BASE + 8,
+};
+
+/* 与 BPF 中的 cgrp_ctx 对齐 */
+struct cgrp_ctx {
+	uint64_t parent_id;
+	uint64_t runtime_ns;
+	uint64_t window_start;
+	uint64_t window_usage;
+	uint64_t bw_period_ns;
+	uint64_t bw_quota_ns;
+	uint64_t bw_period_start;
+	uint64_t bw_usage;
+	uint64_t nr_throttled;
+	uint64_t last_active_ns;
+	uint32_t weight;
+	uint32_t active_weight_sum;
+	uint32_t active_weight_next;
+	uint32_t hweight;
+	uint32_t level;
+	uint32_t active;
+};
+
+/* 与 BPF 中的 latency_class 对齐 */
+struct latency_class {
+	uint64_t slice_ns;      /* 每个周期预留的运行时间；截止时间 = 可运行时间 + slice */
+	uint64_t period_ns;     /* 预留周期，只决定预留速率 slice/period，不是相对截止时间 */
+	uint64_t nr_activations;
+	uint64_t nr_misses;
+	uint64_t max_lateness_ns;
+};
+
+/* 延迟类成员配置：按 PID（含其全部线程）或线程名匹配 */
+struct latency_spec {
+	int pid;                /* 0 表示按 comm 匹配 */
+	char comm[16];
+	uint64_t slice_ns;
+	uint64_t period_ns;
+};
+
+#define MAX_LATENCY_SPECS 64
+#define MAX_LATENCY_TASKS 1024
+#define LAT_CAP_PCT_DEFAULT 25
+#define MAX_LATENCY_REPORT 16           /* 每个采样周期最多输出的延迟类成员数 */
+#define STICKY_MAX_QUEUED_DEFAULT 2   /* 与 BPF 中的 STICKY_MAX_QUEUED_DEFAULT 一致 */
+#define STICKY_MAX_QUEUED_MAX 4096
+#define DISPATCH_BATCH_DEFAULT 4
+#define DISPATCH_BATCH_MAX 32     /* 与 BPF 中的 DISPATCH_BATCH_MAX 一致 */
+#define DISPATCH_BUDGET_US_DEFAULT 5000
+#define TIMEOUT_MS_MAX 30000          /* 内核允许的 watchdog 超时上限 */
+#define TIMEOUT_MS_KERNEL_DEFAULT 30000
+#define SUPERVISE_BACKOFF_MIN 1       /* 重新加载的退避时间（秒） */
+#define SUPERVISE_BACKOFF_MAX 60
+#define SUPERVISE_STABLE_SEC 300      /* 平稳运行超过该时长后退避复位 */
+#define RESTART_QUICK_MAX 3           /* 连续按退出码重启的次数上限，超过后按错误卸载处理 */
+#define WATCHDOG_STALL_SEC 3          /* 有任务排队但无分派进展持续该时长即告警 */
+#define EVENT_LOG_NAME "ejections.log"
+
+/* 与 BPF 中的 policy_profile 对齐 */
+#define NR_GUA 8
+
+enum placement_pref {
+	PLACE_SPREAD = 0,
+	PLACE_PACK = 1,
+};
+
+struct policy_profile {
+	uint64_t slice_ns[NR_GUA];
+	uint32_t dispatch_order[NR_GUA];
+	uint32_t id;
+	uint32_t placement;
+	uint32_t pack_max_queued;
+	uint32_t reserved;
+	uint64_t yang_to_yin_ns;
+	uint64_t yin_to_yang_ns;
+	uint64_t flip_min_ns;
+	uint64_t flip_max_ns;
+};
+
+/* 卦象编号与 DSQ ID（与 BPF 中一致） */
+enum { KUN, ZHEN, KAN, DUI, GEN, LI, XUN, QIAN };
+#define DSQ(gua) ((gua) + 1)
+#define MS(x) ((uint64_t)(x) * 1000000ULL)
+
+struct named_profile {
+	const char *name;
+	const char *desc;
+	struct policy_profile prof;
+};
+
+/* 内置策略方案，balanced 即原有的固定映射 */
+static const struct named_profile profiles[] = {
+	{
+		.name = "balanced",
+		.desc = "默认：乾离长片、坎坤短片，乾卦优先",
+		.prof = {
+			.slice_ns = {
+				[KUN] = MS(1), [ZHEN] = MS(5), [KAN] = MS(1), [DUI] = MS(5),
+				[GEN] = MS(5), [LI] = MS(10), [XUN] = MS(5), [QIAN] = MS(10),
+			},
+			.dispatch_order = {
+				DSQ(QIAN), DSQ(LI), DSQ(ZHEN), DSQ(DUI), DSQ(XUN), DSQ(GEN), DSQ(KAN), DSQ(KUN),
+			},
+			.id = 1,
+			.placement = PLACE_SPREAD,
+			.yang_to_yin_ns = MS(50),
+			.yin_to_yang_ns = MS(100),
+			.flip_min_ns = MS(10),
+			.flip_max_ns = MS(50),
+		},
+	},
+	{
+		.name = "latency",
+		.desc = "前端：短时间片，交互/IO 卦象优先，变卦更快",
+		.prof = {
+			.slice_ns = {
+				[KUN] = MS(1), [ZHEN] = MS(2), [KAN] = MS(1), [DUI] = MS(2),
+				[GEN] = MS(3), [LI] = MS(3), [XUN] = MS(2), [QIAN] = MS(3),
+			},
+			.dispatch_order = {
+				DSQ(ZHEN), DSQ(DUI), DSQ(KAN), DSQ(XUN), DSQ(QIAN), DSQ(LI), DSQ(GEN), DSQ(KUN),
+			},
+			.id = 2,
+			.placement = PLACE_SPREAD,
+			.yang_to_yin_ns = MS(20),
+			.yin_to_yang_ns = MS(40),
+			.flip_min_ns = MS(5),
+			.flip_max_ns = MS(20),
+		},
+	},
+	{
+		.name = "throughput",
+		.desc = "批处理：长时间片减少切换，计算型卦象优先，变卦更慢",
+		.prof = {
+			.slice_ns = {
+				[KUN] = MS(5), [ZHEN] = MS(10), [KAN] = MS(5), [DUI] = MS(10),
+				[GEN] = MS(10), [LI] = MS(20), [XUN] = MS(10), [QIAN] = MS(20),
+			},
+			.dispatch_order = {
+				DSQ(QIAN), DSQ(LI), DSQ(GEN), DSQ(XUN), DSQ(ZHEN), DSQ(DUI), DSQ(KAN), DSQ(KUN),
+			},
+			.id = 3,
+			.placement = PLACE_SPREAD,
+			.yang_to_yin_ns = MS(200),
+			.yin_to_yang_ns = MS(400),
+			.flip_min_ns = MS(40),
+			.flip_max_ns = MS(200),
+		},
+	},
+	{
+		.name = "power",
+		.desc = "省电：坤/坎集中到最少的核心，其余核心进入深度空闲",
+		.prof = {
+			.slice_ns = {
+				[KUN] = MS(4), [ZHEN] = MS(5), [KAN] = MS(2), [DUI] = MS(5),
+				[GEN] = MS(5), [LI] = MS(10), [XUN] = MS(5), [QIAN] = MS(10),
+			},
+			.dispatch_order = {
+				DSQ(QIAN), DSQ(LI), DSQ(ZHEN), DSQ(DUI), DSQ(XUN), DSQ(GEN), DSQ(KAN), DSQ(KUN),
+			},
+			.id = 4,
+			.placement = PLACE_PACK,
+			.pack_max_queued = 4,
+			.yang_to_yin_ns = MS(50),
+			.yin_to_yang_ns = MS(100),
+			.flip_min_ns = MS(10),
+			.flip_max_ns = MS(50),
+		},
+	},
+};
+
+#define NR_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+#define HWEIGHT_ONE 65536
+#define MAX_CGRP_REPORT 10
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+static const char *const gua_names[8] = {
+	"KUN", "ZHEN", "KAN", "DUI", "GEN", "LI", "XUN", "QIAN",
 };
 
 enum output_format {
-	OUTPUT_BOTH = 0,
+	OUTPUT_BIN = 0,  /* 单个 .scxs 快照文件（默认） */
 	OUTPUT_JSON = 1,
 	OUTPUT_CSV = 2,
+	OUTPUT_BOTH = 3, /* 每个采样周期一份 JSON + CSV */
+	OUTPUT_ALL = 4,  /* .scxs + JSON + CSV（同一次采样，用于核对快照文件） */
+};
+
+static const char *const output_format_names[] = {
+	[OUTPUT_BIN] = "bin",
+	[OUTPUT_JSON] = "json",
+	[OUTPUT_CSV] = "csv",
+	[OUTPUT_BOTH] = "both",
+	[OUTPUT_ALL] = "all",
 };
 
+#define OUTPUT_HAS_BIN(fmt)  ((fmt) == OUTPUT_BIN || (fmt) == OUTPUT_ALL)
+#define OUTPUT_HAS_JSON(fmt) ((fmt) == OUTPUT_JSON || (fmt) == OUTPUT_BOTH || (fmt) == OUTPUT_ALL)
+#define OUTPUT_HAS_CSV(fmt)  ((fmt) == OUTPUT_CSV || (fmt) == OUTPUT_BOTH || (fmt) == OUTPUT_ALL)
+
 static volatile sig_atomic_t exiting = 0;
 
 static void handle_signal(int sig)
@@ -80,44 +327,58 @@ static int ensure_dir_exists(const char *dir)
 	return 0;
 }
 
-static int dump_task_ctx_json(int map_fd, const char *path, long long ts_sec)
+/* 通过 iter/task 迭代器一次读出全部任务快照，返回记录数，失败返回 -1 */
+static ssize_t read_task_snapshots(struct sched_bpf *skel, struct task_snapshot **out)
 {
-	FILE *f = fopen(path, "w");
-	if (!f) {
-		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+	static char *buf;
+	static size_t cap;
+	size_t len = 0;
+	int iter_fd;
+
+	if (!skel->links.dump_task_snapshot) {
+		fprintf(stderr, "Task iterator is not attached\n");
 		return -1;
 	}
 
-	fprintf(f, "{\"timestamp\":%lld,\"tasks\":[", ts_sec);
+	iter_fd = bpf_iter_create(bpf_link__fd(skel->links.dump_task_snapshot));
+	if (iter_fd < 0) {
+		fprintf(stderr, "Failed to create task iterator: %s\n", strerror(errno));
+		return -1;
+	}
 
-	uint32_t key = 0, next_key = 0;
-	struct task_ctx val = {0};
-	int first = 1;
-	int err = bpf_map_get_next_key(map_fd, NULL, &next_key);
-	while (!err) {
-		if (bpf_map_lookup_elem(map_fd, &next_key, &val) == 0) {
-			if (!first)
-				fprintf(f, ",");
-			fprintf(
-				f,
-				"{\"pid\":%u,\"current_gua\":%u,\"assigned_cpu\":%u,\"current_element\":%u,\"enqueue_time\":%llu}",
-				next_key,
-				val.current_gua,
-				val.assigned_cpu,
-				val.current_element,
-				(unsigned long long)val.enqueue_time);
-			first = 0;
+	for (;;) {
+		ssize_t n;
+
+		if (cap - len < 65536) {
+			size_t new_cap = cap ? cap * 2 : 1 << 20;
+			char *tmp = realloc(buf, new_cap);
+			if (!tmp) {
+				close(iter_fd);
+				return -1;
+			}
+			buf = tmp;
+			cap = new_cap;
 		}
-		key = next_key;
-		err = bpf_map_get_next_key(map_fd, &key, &next_key);
+
+		n = read(iter_fd, buf + len, cap - len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Failed to read task iterator: %s\n", strerror(errno));
+			close(iter_fd);
+			return -1;
+		}
+		if (n == 0)
+			break;
+		len += n;
 	}
 
-	fprintf(f, "]}\n");
-	fclose(f);
-	return 0;
+	close(iter_fd);
+	*out = (struct task_snapshot *)buf;
+	return len / sizeof(struct task_snapshot);
 }
 
-static int dump_task_ctx_csv(int map_fd, const char *path, long long ts_sec)
+static int dump_task_ctx_json(const struct task_snapshot *recs, size_t nr, const char *path, long long ts_sec)
 {
 	FILE *f = fopen(path, "w");
 	if (!f) {
@@ -125,27 +386,21 @@ static int dump_task_ctx_csv(int map_fd, const char *path, long long ts_sec)
 		return -1;
 	}
 
-	fprintf(f, "timestamp,pid,current_gua,assigned_cpu,current_element,enqueue_time\n");
+	snap_write_json(f, ts_sec, recs, nr);
+	fclose(f);
+	return 0;
+}
 
-	uint32_t key = 0, next_key = 0;
-	struct task_ctx val = {0};
-	int err = bpf_map_get_next_key(map_fd, NULL, &next_key);
-	while (!err) {
-		if (bpf_map_lookup_elem(map_fd, &next_key, &val) == 0) {
-			fprintf(
-				f,
-				"%lld,%u,%u,%u,%u,%llu\n",
-				ts_sec,
-				next_key,
-				val.current_gua,
-				val.assigned_cpu,
-				val.current_element,
-				(unsigned long long)val.enqueue_time);
-		}
-		key = next_key;
-		err = bpf_map_get_next_key(map_fd, &key, &next_key);
+static int dump_task_ctx_csv(const struct task_snapshot *recs, size_t nr, const char *path, long long ts_sec)
+{
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
 	}
 
+	snap_write_csv_header(f);
+	snap_write_csv_rows(f, ts_sec, recs, nr);
 	fclose(f);
 	return 0;
 }
@@ -168,12 +423,663 @@ static void init_sys_config(struct sys_config *config)
 	 * 检测小核/大核配置（P-core/E-core）
 	 * 在Arm big.LITTLE或Intel P+E架构中
 	 * 此处为启发式估计：假设后半部分为能效核心
+	 * refresh_cpu_topology() 会按在线 CPU 与核心容量重新划分
 	 */
 	config->num_perf_cpus = (num_cpus + 1) / 2;  /* 性能核心为前半部分 */
 	config->num_eff_cpus = num_cpus / 2;         /* 能效核心为后半部分 */
 
-	fprintf(stderr, "System config: num_cpus=%u, perf=%u, eff=%u\n",
-		config->num_cpus, config->num_perf_cpus, config->num_eff_cpus);
+	fprintf(stderr, "System config: num_cpus=%u\n", config->num_cpus);
+}
+
+/* 读取 CPU 的末级缓存编号：取层级最高的 cache index 的 id */
+static uint32_t read_cpu_llc_id(int cpu)
+{
+	char path[128];
+	int best_level = -1;
+	uint32_t llc_id = 0;
+
+	for (int idx = 0; idx < 8; idx++) {
+		int level = -1;
+		unsigned int id = 0;
+		FILE *f;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, idx);
+		f = fopen(path, "r");
+		if (!f)
+			break;
+		if (fscanf(f, "%d", &level) != 1)
+			level = -1;
+		fclose(f);
+		if (level <= best_level)
+			continue;
+
+		/* 优先读 id，老内核没有 id 时用 shared_cpu_list 的首个 CPU 代替 */
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/id", cpu, idx);
+		f = fopen(path, "r");
+		if (!f) {
+			snprintf(path, sizeof(path),
+				"/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, idx);
+			f = fopen(path, "r");
+		}
+		if (!f)
+			continue;
+		if (fscanf(f, "%u", &id) == 1) {
+			best_level = level;
+			llc_id = id;
+		}
+		fclose(f);
+	}
+
+	return llc_id;
+}
+
+/* 解析 cpulist 格式（如 "0-3,6,8-9"） */
+static int parse_cpulist(const char *str, bool mask[MAX_CPUS])
+{
+	const char *p = str;
+	int nr = 0;
+
+	memset(mask, 0, sizeof(bool) * MAX_CPUS);
+	while (*p) {
+		char *end;
+		long lo = strtol(p, &end, 10), hi;
+
+		if (end == p)
+			break;
+		hi = lo;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		for (long cpu = lo; cpu <= hi && cpu < MAX_CPUS; cpu++) {
+			if (cpu >= 0 && !mask[cpu]) {
+				mask[cpu] = true;
+				nr++;
+			}
+		}
+		p = end;
+		if (*p == ',')
+			p++;
+		else
+			break;
+	}
+	return nr;
+}
+
+static int read_sysfs_str(const char *path, char *buf, size_t len)
+{
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return -1;
+	if (!fgets(buf, len, f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+/* 核心容量：优先 cpu_capacity（Arm），其次 cpufreq 的最大频率（Intel P/E 核） */
+static uint64_t read_cpu_capacity(int cpu)
+{
+	char path[128], buf[64];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpu_capacity", cpu);
+	if (read_sysfs_str(path, buf, sizeof(buf)) == 0)
+		return strtoull(buf, NULL, 10);
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+	if (read_sysfs_str(path, buf, sizeof(buf)) == 0)
+		return strtoull(buf, NULL, 10);
+	return 0;
+}
+
+/*
+ * 检测在线 CPU 并刷新拓扑 map：每个 CPU 的 LLC/在线/性能核标志、在线 CPU 紧凑列表、
+ * 以及 sys_config 中的性能/能效核心数。online 与上次相同时直接返回（除非 force）。
+ */
+static int refresh_cpu_topology(struct sched_bpf *skel, struct sys_config *config, bool force)
+{
+	static char last_online[1024];
+	static struct cpu_lists lists;
+	static uint32_t seq;
+	char online_str[1024];
+	bool online[MAX_CPUS];
+	uint64_t capacity[MAX_CPUS] = {0}, max_cap = 0, min_cap = UINT64_MAX;
+	uint32_t nr_llc_cpus[MAX_CPUS] = {0};
+	int topo_fd = bpf_map__fd(skel->maps.cpu_topo_map);
+	int lists_fd = bpf_map__fd(skel->maps.cpu_lists_map);
+	uint32_t key = 0, nr_online = 0, nr_perf_target;
+
+	if (topo_fd < 0 || lists_fd < 0) {
+		fprintf(stderr, "Failed to get cpu topology map fds\n");
+		return -1;
+	}
+
+	if (read_sysfs_str("/sys/devices/system/cpu/online", online_str, sizeof(online_str)) != 0)
+		snprintf(online_str, sizeof(online_str), "0-%u", config->num_cpus - 1);
+	if (!force && !strcmp(online_str, last_online))
+		return 0;
+
+	parse_cpulist(online_str, online);
+	for (uint32_t cpu = 0; cpu < config->num_cpus && cpu < MAX_CPUS; cpu++) {
+		if (!online[cpu])
+			continue;
+		nr_online++;
+		capacity[cpu] = read_cpu_capacity(cpu);
+		if (capacity[cpu] > max_cap)
+			max_cap = capacity[cpu];
+		if (capacity[cpu] < min_cap)
+			min_cap = capacity[cpu];
+	}
+	if (nr_online == 0) {
+		fprintf(stderr, "No online CPUs found in '%s'\n", online_str);
+		return -1;
+	}
+
+	/* 核心容量相同（同构 CPU）时沿用启发式：在线 CPU 的前一半为性能核心 */
+	nr_perf_target = (nr_online + 1) / 2;
+
+	memset(&lists, 0, sizeof(lists));
+	for (uint32_t cpu = 0; cpu < config->num_cpus && cpu < MAX_CPUS; cpu++) {
+		struct cpu_topo topo = {
+			.llc_id = read_cpu_llc_id(cpu),
+			.offline = !online[cpu],
+			.present = 1,
+		};
+
+		if (online[cpu]) {
+			if (max_cap != min_cap)
+				topo.is_perf = capacity[cpu] == max_cap;
+			else
+				topo.is_perf = lists.nr_online < nr_perf_target;
+
+			lists.online[lists.nr_online++] = cpu;
+			if (topo.is_perf)
+				lists.perf[lists.nr_perf++] = cpu;
+			else
+				lists.eff[lists.nr_eff++] = cpu;
+			if (topo.llc_id < MAX_CPUS)
+				nr_llc_cpus[topo.llc_id]++;
+		}
+
+		if (bpf_map_update_elem(topo_fd, &cpu, &topo, 0) != 0) {
+			fprintf(stderr, "Failed to update cpu_topo_map[%u]: %s\n", cpu, strerror(errno));
+			return -1;
+		}
+	}
+
+	lists.seq = ++seq;
+	if (bpf_map_update_elem(lists_fd, &key, &lists, 0) != 0) {
+		fprintf(stderr, "Failed to update cpu_lists_map: %s\n", strerror(errno));
+		return -1;
+	}
+
+	config->num_perf_cpus = lists.nr_perf;
+	config->num_eff_cpus = lists.nr_eff;
+
+	fprintf(stderr, "CPU topology: online=%s (%u), perf=%u, eff=%u\n",
+		online_str, lists.nr_online, lists.nr_perf, lists.nr_eff);
+	for (int llc = 0; llc < MAX_CPUS; llc++) {
+		if (nr_llc_cpus[llc])
+			fprintf(stderr, "LLC %d: %u online cpus\n", llc, nr_llc_cpus[llc]);
+	}
+
+	snprintf(last_online, sizeof(last_online), "%s", online_str);
+	return 1;
+}
+
+/* 汇总各 CPU 的统计计数器 */
+static int read_stats(struct sched_bpf *skel, uint64_t stats[NR_STATS])
+{
+	int map_fd = bpf_map__fd(skel->maps.stats_map);
+	int nr_cpus = libbpf_num_possible_cpus();
+	uint64_t *vals;
+
+	if (map_fd < 0 || nr_cpus <= 0)
+		return -1;
+
+	vals = calloc(nr_cpus, sizeof(*vals));
+	if (!vals)
+		return -1;
+
+	memset(stats, 0, sizeof(uint64_t) * NR_STATS);
+	for (uint32_t idx = 0; idx < NR_STATS; idx++) {
+		if (bpf_map_lookup_elem(map_fd, &idx, vals) != 0)
+			continue;
+		for (int cpu = 0; cpu < nr_cpus; cpu++)
+			stats[idx] += vals[cpu];
+	}
+
+	free(vals);
+	return 0;
+}
+
+static void print_stats(struct sched_bpf *skel)
+{
+	static uint64_t prev[NR_STATS];
+	static long long prev_ns;
+	uint64_t stats[NR_STATS];
+	uint64_t hit, miss, migrations = 0, calls, tasks;
+	struct timespec ts;
+	long long now_ns;
+	double secs;
+
+	if (read_stats(skel, stats) != 0)
+		return;
+
+	/* 计数器单调递增；变小说明调度器已重新加载，从零重新计算增量 */
+	if (stats[STAT_DISPATCH_CALLS] < prev[STAT_DISPATCH_CALLS]) {
+		memset(prev, 0, sizeof(prev));
+		prev_ns = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now_ns = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	secs = prev_ns ? (now_ns - prev_ns) / 1e9 : 0.0;
+	prev_ns = now_ns;
+
+	hit = stats[STAT_WAKE_LLC_HIT];
+	miss = stats[STAT_WAKE_LLC_MISS];
+	printf("wake: affine_sync=%llu affine_llc=%llu affine_full=%llu llc_hit=%llu llc_miss=%llu (%.1f%% local)\n",
+		(unsigned long long)stats[STAT_WAKE_AFFINE_SYNC],
+		(unsigned long long)stats[STAT_WAKE_AFFINE_LLC],
+		(unsigned long long)stats[STAT_WAKE_AFFINE_FULL],
+		(unsigned long long)hit,
+		(unsigned long long)miss,
+		hit + miss ? 100.0 * hit / (hit + miss) : 0.0);
+	printf("sticky: hot=%llu overload=%llu\n",
+		(unsigned long long)stats[STAT_STICKY_HOT],
+		(unsigned long long)stats[STAT_STICKY_OVERLOAD]);
+	printf("cgroup: over_share_skips=%llu throttled_skips=%llu\n",
+		(unsigned long long)stats[STAT_CGRP_OVER_SHARE],
+		(unsigned long long)stats[STAT_CGRP_THROTTLED]);
+	printf("placement: packed=%llu\n", (unsigned long long)stats[STAT_PACKED]);
+	printf("task_ctx: update_failures=%llu\n", (unsigned long long)stats[STAT_TASK_CTX_FULL]);
+	printf("hotplug: online=%llu offline=%llu redirected=%llu\n",
+		(unsigned long long)stats[STAT_CPU_ONLINE],
+		(unsigned long long)stats[STAT_CPU_OFFLINE],
+		(unsigned long long)stats[STAT_OFFLINE_REDIRECT]);
+	printf("latency: enqueued=%llu dispatched=%llu over_cap=%llu ineligible=%llu deadline_miss=%llu\n",
+		(unsigned long long)stats[STAT_LAT_ENQUEUE],
+		(unsigned long long)stats[STAT_LAT_DISPATCH],
+		(unsigned long long)stats[STAT_LAT_OVER_CAP],
+		(unsigned long long)stats[STAT_LAT_INELIGIBLE],
+		(unsigned long long)stats[STAT_LAT_DEADLINE_MISS]);
+
+	/* dispatch 开销按采样周期输出速率：批量搬运越多，回调与空探查越少 */
+	calls = stats[STAT_DISPATCH_CALLS] - prev[STAT_DISPATCH_CALLS];
+	tasks = stats[STAT_DISPATCH_TASKS] - prev[STAT_DISPATCH_TASKS];
+	printf("dispatch: calls=%.0f/s tasks=%.0f/s (%.2f per call) empty_probes=%.0f/s hint_skips=%.0f/s idle_kicks=%.0f/s\n",
+		secs > 0 ? calls / secs : 0.0,
+		secs > 0 ? tasks / secs : 0.0,
+		calls ? (double)tasks / calls : 0.0,
+		secs > 0 ? (stats[STAT_DISPATCH_EMPTY_PROBE] - prev[STAT_DISPATCH_EMPTY_PROBE]) / secs : 0.0,
+		secs > 0 ? (stats[STAT_DISPATCH_HINT_SKIP] - prev[STAT_DISPATCH_HINT_SKIP]) / secs : 0.0,
+		secs > 0 ? (stats[STAT_DISPATCH_KICK] - prev[STAT_DISPATCH_KICK]) / secs : 0.0);
+
+	/* 迁移按采样周期输出增量，便于发现迁移风暴 */
+	for (int gua = 0; gua < 8; gua++)
+		migrations += stats[STAT_MIGRATE_BASE + gua] - prev[STAT_MIGRATE_BASE + gua];
+	printf("migrations/interval: total=%llu", (unsigned long long)migrations);
+	for (int gua = 0; gua < 8; gua++)
+		printf(" %s=%llu", gua_names[gua],
+			(unsigned long long)(stats[STAT_MIGRATE_BASE + gua] - prev[STAT_MIGRATE_BASE + gua]));
+	printf("\n");
+	fflush(stdout);
+
+	memcpy(prev, stats, sizeof(prev));
+}
+
+/* cgroup v2 中 cgroup id 即 cgroupfs 目录的 inode 号，借此反查路径 */
+static uint64_t cgrp_lookup_id;
+static char cgrp_lookup_path[256];
+
+static int cgrp_path_visit(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	(void)ftw;
+	if (type == FTW_D && (uint64_t)st->st_ino == cgrp_lookup_id) {
+		snprintf(cgrp_lookup_path, sizeof(cgrp_lookup_path), "%s", path + strlen(CGROUP_ROOT));
+		return 1;
+	}
+	return 0;
+}
+
+static const char *cgrp_path(uint64_t cgid)
+{
+	cgrp_lookup_id = cgid;
+	snprintf(cgrp_lookup_path, sizeof(cgrp_lookup_path), "id:%llu", (unsigned long long)cgid);
+	nftw(CGROUP_ROOT, cgrp_path_visit, 16, FTW_PHYS | FTW_MOUNT);
+	if (!cgrp_lookup_path[0])
+		return "/";
+	return cgrp_lookup_path;
+}
+
+struct cgrp_usage {
+	uint64_t id;
+	uint64_t runtime_ns;
+	uint64_t delta_ns;
+	struct cgrp_ctx ctx;
+};
+
+static int cmp_cgrp_usage(const void *a, const void *b)
+{
+	const struct cgrp_usage *ua = a, *ub = b;
+	if (ua->delta_ns == ub->delta_ns)
+		return 0;
+	return ua->delta_ns < ub->delta_ns ? 1 : -1;
+}
+
+/* 输出本周期 CPU 时间最多的若干 cgroup */
+static void print_cgroup_stats(struct sched_bpf *skel)
+{
+	static struct cgrp_usage *prev;
+	static size_t nr_prev;
+	struct cgrp_usage *cur = NULL;
+	size_t nr_cur = 0, cap = 0;
+	uint64_t key, next_key;
+	int map_fd = bpf_map__fd(skel->maps.cgrp_ctx_map);
+	int err;
+
+	if (map_fd < 0)
+		return;
+
+	err = bpf_map_get_next_key(map_fd, NULL, &next_key);
+	while (!err) {
+		struct cgrp_ctx val;
+
+		if (bpf_map_lookup_elem(map_fd, &next_key, &val) == 0) {
+			if (nr_cur == cap) {
+				size_t new_cap = cap ? cap * 2 : 64;
+				struct cgrp_usage *tmp = realloc(cur, new_cap * sizeof(*cur));
+				if (!tmp)
+					break;
+				cur = tmp;
+				cap = new_cap;
+			}
+			cur[nr_cur].id = next_key;
+			cur[nr_cur].runtime_ns = val.runtime_ns;
+			cur[nr_cur].delta_ns = val.runtime_ns;
+			cur[nr_cur].ctx = val;
+			for (size_t i = 0; i < nr_prev; i++) {
+				if (prev[i].id == next_key && prev[i].runtime_ns <= val.runtime_ns) {
+					cur[nr_cur].delta_ns = val.runtime_ns - prev[i].runtime_ns;
+					break;
+				}
+			}
+			nr_cur++;
+		}
+		key = next_key;
+		err = bpf_map_get_next_key(map_fd, &key, &next_key);
+	}
+
+	qsort(cur, nr_cur, sizeof(*cur), cmp_cgrp_usage);
+	for (size_t i = 0; i < nr_cur && i < MAX_CGRP_REPORT; i++) {
+		const struct cgrp_ctx *c = &cur[i].ctx;
+
+		if (cur[i].delta_ns == 0)
+			break;
+		printf("cgroup %s: weight=%u hweight=%.1f%% runtime=%llums (+%llums) throttled=%llu",
+			cgrp_path(cur[i].id),
+			c->weight,
+			100.0 * c->hweight / HWEIGHT_ONE,
+			(unsigned long long)(c->runtime_ns / 1000000),
+			(unsigned long long)(cur[i].delta_ns / 1000000),
+			(unsigned long long)c->nr_throttled);
+		if (c->bw_quota_ns)
+			printf(" max=%llu/%llu",
+				(unsigned long long)(c->bw_quota_ns / 1000),
+				(unsigned long long)(c->bw_period_ns / 1000));
+		printf("\n");
+	}
+	fflush(stdout);
+
+	free(prev);
+	prev = cur;
+	nr_prev = nr_cur;
+}
+
+/* 解析 PID|COMM[:slice_us[:period_us]] */
+static int parse_latency_spec(const char *arg, struct latency_spec *spec)
+{
+	char buf[64], *tok, *save = NULL, *end;
+	unsigned long long slice_us = 1000, period_us = 10000;
+
+	memset(spec, 0, sizeof(*spec));
+	snprintf(buf, sizeof(buf), "%s", arg);
+
+	tok = strtok_r(buf, ":", &save);
+	if (!tok)
+		return -1;
+	spec->pid = strtol(tok, &end, 10);
+	if (*end != '\0' || spec->pid <= 0) {
+		spec->pid = 0;
+		snprintf(spec->comm, sizeof(spec->comm), "%s", tok);
+	}
+
+	if ((tok = strtok_r(NULL, ":", &save)))
+		slice_us = strtoull(tok, NULL, 10);
+	if ((tok = strtok_r(NULL, ":", &save)))
+		period_us = strtoull(tok, NULL, 10);
+	if (slice_us == 0 || period_us == 0 || slice_us > period_us)
+		return -1;
+
+	spec->slice_ns = slice_us * 1000;
+	spec->period_ns = period_us * 1000;
+	return 0;
+}
+
+struct latency_task {
+	uint32_t tid;
+	const struct latency_spec *spec;
+};
+
+/*
+ * 按配置从迭代器返回的任务快照中找出当前存在的成员线程（PID 匹配 tgid，COMM 匹配线程名），
+ * 先匹配到的配置优先。快照只包含本调度器管理过的线程，尚未入队过的线程在其首次入队后的下一轮同步中加入。
+ */
+static size_t collect_latency_tasks(const struct latency_spec *specs, size_t nr_specs,
+				    const struct task_snapshot *recs, size_t nr_recs, struct latency_task *cand)
+{
+	size_t nr = 0;
+
+	for (size_t j = 0; j < nr_recs && nr < MAX_LATENCY_TASKS; j++) {
+		for (size_t i = 0; i < nr_specs; i++) {
+			if (specs[i].pid ? recs[j].tgid == (uint32_t)specs[i].pid :
+					   !strncmp(recs[j].comm, specs[i].comm, sizeof(specs[i].comm) - 1)) {
+				cand[nr].tid = recs[j].pid;
+				cand[nr].spec = &specs[i];
+				nr++;
+				break;
+			}
+		}
+	}
+	return nr;
+}
+
+/*
+ * 同步延迟类成员并做准入控制：已有成员优先保留，新成员只有在
+ * sum(slice/period) 不超过 cap_pct% x 在线 CPU 数时才被接纳；已退出的线程从 map 中删除。
+ */
+static void sync_latency_members(struct sched_bpf *skel, const struct latency_spec *specs, size_t nr_specs,
+				 const struct task_snapshot *recs, size_t nr_recs, uint32_t cap_pct, uint32_t nr_online)
+{
+	static struct latency_task cand[MAX_LATENCY_TASKS];
+	static uint32_t rejected[MAX_LATENCY_TASKS];
+	static size_t nr_rejected;
+	uint32_t members[MAX_LATENCY_TASKS];
+	bool keep[MAX_LATENCY_TASKS] = {0}, admitted[MAX_LATENCY_TASKS] = {0};
+	size_t nr_cand, nr_members = 0, nr_new_rejected = 0;
+	uint64_t util = 0, capacity = (uint64_t)cap_pct * 10 * nr_online; /* 千分比 */
+	uint32_t key, next_key;
+	int map_fd = bpf_map__fd(skel->maps.latency_map);
+	int err;
+
+	if (map_fd < 0 || nr_specs == 0)
+		return;
+
+	nr_cand = collect_latency_tasks(specs, nr_specs, recs, nr_recs, cand);
+
+	err = bpf_map_get_next_key(map_fd, NULL, &next_key);
+	while (!err && nr_members < MAX_LATENCY_TASKS) {
+		members[nr_members++] = next_key;
+		key = next_key;
+		err = bpf_map_get_next_key(map_fd, &key, &next_key);
+	}
+
+	/* 已有成员先计入利用率，保证准入结果稳定 */
+	for (size_t i = 0; i < nr_members; i++) {
+		for (size_t j = 0; j < nr_cand; j++) {
+			if (cand[j].tid != members[i])
+				continue;
+			keep[i] = true;
+			admitted[j] = true;
+			util += cand[j].spec->slice_ns * 1000 / cand[j].spec->period_ns;
+			break;
+		}
+		if (!keep[i])
+			bpf_map_delete_elem(map_fd, &members[i]);
+	}
+
+	for (size_t j = 0; j < nr_cand; j++) {
+		const struct latency_spec *spec = cand[j].spec;
+		uint64_t u = spec->slice_ns * 1000 / spec->period_ns;
+		struct latency_class lc = {
+			.slice_ns = spec->slice_ns,
+			.period_ns = spec->period_ns,
+		};
+		bool seen = false;
+
+		if (admitted[j])
+			continue;
+
+		if (util + u <= capacity &&
+		    bpf_map_update_elem(map_fd, &cand[j].tid, &lc, BPF_NOEXIST) == 0) {
+			util += u;
+			fprintf(stderr, "latency: admitted tid %u (%.1f%% of a cpu), total %.1f%%\n",
+				cand[j].tid, u / 10.0, util / 10.0);
+			continue;
+		}
+
+		/* 被拒绝的线程只提示一次 */
+		for (size_t i = 0; i < nr_rejected; i++)
+			seen |= rejected[i] == cand[j].tid;
+		if (!seen)
+			fprintf(stderr, "latency: rejected tid %u: %.1f%% + %.1f%% exceeds cap %.1f%%\n",
+				cand[j].tid, util / 10.0, u / 10.0, capacity / 10.0);
+		if (nr_new_rejected < MAX_LATENCY_TASKS)
+			rejected[nr_new_rejected++] = cand[j].tid;
+	}
+	nr_rejected = nr_new_rejected;
+}
+
+/* 输出延迟类成员的截止时间统计 */
+static void print_latency_stats(struct sched_bpf *skel)
+{
+	int map_fd = bpf_map__fd(skel->maps.latency_map);
+	uint32_t key, next_key;
+	int err, shown = 0;
+
+	if (map_fd < 0)
+		return;
+
+	err = bpf_map_get_next_key(map_fd, NULL, &next_key);
+	while (!err && shown < MAX_LATENCY_REPORT) {
+		struct latency_class lc;
+		char path[64], comm[32] = "?";
+
+		if (bpf_map_lookup_elem(map_fd, &next_key, &lc) == 0) {
+			snprintf(path, sizeof(path), "/proc/%u/comm", next_key);
+			read_sysfs_str(path, comm, sizeof(comm));
+			printf("latency tid %u (%s): slice=%lluus period=%lluus activations=%llu misses=%llu max_late=%lluus\n",
+				next_key, comm,
+				(unsigned long long)(lc.slice_ns / 1000),
+				(unsigned long long)(lc.period_ns / 1000),
+				(unsigned long long)lc.nr_activations,
+				(unsigned long long)lc.nr_misses,
+				(unsigned long long)(lc.max_lateness_ns / 1000));
+			shown++;
+		}
+		key = next_key;
+		err = bpf_map_get_next_key(map_fd, &key, &next_key);
+	}
+	fflush(stdout);
+}
+
+static const struct named_profile *find_profile(const char *name)
+{
+	for (size_t i = 0; i < NR_PROFILES; i++) {
+		if (!strcmp(profiles[i].name, name))
+			return &profiles[i];
+	}
+	return NULL;
+}
+
+static void list_profiles(FILE *f)
+{
+	for (size_t i = 0; i < NR_PROFILES; i++)
+		fprintf(f, "  %-10s %s\n", profiles[i].name, profiles[i].desc);
+}
+
+/* 将策略方案写入BPF map，可在运行时重复调用以切换方案 */
+/* 写入非活动槽位后再切换 profile_slot，BPF 不会读到新旧方案混合的内容 */
+static int write_profile_to_bpf(struct sched_bpf *skel, const struct named_profile *np)
+{
+	int map_fd = bpf_map__fd(skel->maps.profile_map);
+	uint32_t key = __atomic_load_n(&skel->bss->profile_slot, __ATOMIC_ACQUIRE) ^ 1;
+
+	if (map_fd < 0) {
+		fprintf(stderr, "Failed to get profile_map fd: %d\n", map_fd);
+		return -1;
+	}
+	if (bpf_map_update_elem(map_fd, &key, &np->prof, 0) != 0) {
+		fprintf(stderr, "Failed to update profile_map: %s\n", strerror(errno));
+		return -1;
+	}
+	__atomic_store_n(&skel->bss->profile_slot, key, __ATOMIC_RELEASE);
+
+	fprintf(stderr, "Policy profile: %s\n", np->name);
+	return 0;
+}
+
+/* 标准输入不是终端（管道、FIFO），或加载器位于终端的前台进程组时才读取命令 */
+static bool stdin_in_foreground(void)
+{
+	return !isatty(STDIN_FILENO) || tcgetpgrp(STDIN_FILENO) == getpgrp();
+}
+
+/* 处理标准输入上的运行时命令 */
+static void handle_command(struct sched_bpf *skel, char *line, const struct named_profile **cur)
+{
+	char *cmd = strtok(line, " \t\r\n");
+	char *arg = strtok(NULL, " \t\r\n");
+
+	if (!cmd)
+		return;
+
+	if (!strcmp(cmd, "profile")) {
+		const struct named_profile *np;
+
+		if (!arg) {
+			printf("current profile: %s\n", (*cur)->name);
+			list_profiles(stdout);
+			return;
+		}
+		np = find_profile(arg);
+		if (!np) {
+			fprintf(stderr, "Unknown profile: %s\n", arg);
+			return;
+		}
+		if (write_profile_to_bpf(skel, np) == 0)
+			*cur = np;
+		return;
+	}
+
+	if (!strcmp(cmd, "stats")) {
+		print_stats(skel);
+		return;
+	}
+
+	fprintf(stderr, "Unknown command: %s (commands: profile [name], stats)\n", cmd);
 }
 
 /* 将系统配置写入BPF map */
@@ -202,124 +1108,638 @@ static int write_sys_config_to_bpf(struct sched_bpf *skel, struct sys_config *co
 	return 0;
 }
 
-int main(int argc, char **argv)
+/* 与 BPF 中的 NR_HEALTH_DSQ 对齐（按 DSQ ID 索引，0 未使用） */
+#define NR_HEALTH_DSQ 10
+#define DSQ_LATENCY 9
+
+/* 运行内核的 BTF，只加载一次，进程退出时释放 */
+static const struct btf *vmlinux_btf(void)
 {
-	struct sched_bpf *skel = NULL;
-	int err;
-	const char *out_dir = "./scx";
-	int interval_ms = 10000;
-	enum output_format fmt = OUTPUT_BOTH;
+	static struct btf *btf;
+	static bool loaded;
 
-	for (int i = 1; i < argc; i++) {
-		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
-			out_dir = argv[++i];
-			continue;
-		}
-		if (!strcmp(argv[i], "-i") && i + 1 < argc) {
-			interval_ms = atoi(argv[++i]);
-			if (interval_ms <= 0)
-				interval_ms = 1000;
-			continue;
-		}
-		if (!strcmp(argv[i], "--format") && i + 1 < argc) {
-			const char *opt = argv[++i];
-			if (!strcmp(opt, "json"))
-				fmt = OUTPUT_JSON;
-			else if (!strcmp(opt, "csv"))
-				fmt = OUTPUT_CSV;
-			else
-				fmt = OUTPUT_BOTH;
-			continue;
+	if (!loaded) {
+		btf = btf__load_vmlinux_btf();
+		loaded = true;
+	}
+	return btf;
+}
+
+/* 运行内核的 sched_ext_ops 是否有指定回调（vmlinux.h 可能比运行内核新） */
+static bool kernel_has_ops_member(const char *name)
+{
+	const struct btf *btf = vmlinux_btf();
+	const struct btf_type *t;
+	const struct btf_member *m;
+	int id;
+
+	if (!btf || (id = btf__find_by_name_kind(btf, "sched_ext_ops", BTF_KIND_STRUCT)) <= 0)
+		return false;
+	t = btf__type_by_id(btf, id);
+	m = btf_members(t);
+	for (int i = 0; i < btf_vlen(t); i++, m++) {
+		if (!strcmp(btf__name_by_offset(btf, m->name_off), name))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * 退出类型（enum scx_exit_kind）的名字与取值从运行内核的 BTF 中查找，不在加载器中复制内核定义。
+ * 按名字查值时 by_name 非空，按值查名字时返回枚举项名；找不到返回 NULL。
+ */
+static const char *exit_kind_lookup(const char *by_name, long long *val)
+{
+	const struct btf *btf = vmlinux_btf();
+	const struct btf_type *t;
+	const struct btf_enum *e;
+	int id;
+
+	if (!btf || (id = btf__find_by_name_kind(btf, "scx_exit_kind", BTF_KIND_ENUM)) <= 0)
+		return NULL;
+	t = btf__type_by_id(btf, id);
+	e = btf_enum(t);
+	for (int i = 0; i < btf_vlen(t); i++, e++) {
+		const char *name = btf__name_by_offset(btf, e->name_off);
+
+		if (by_name ? !strcmp(name, by_name) : e->val == *val) {
+			*val = e->val;
+			return name;
 		}
-		if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
-			printf("Usage: %s [-o out_dir] [-i interval_ms] [--format json|csv|both]\n", argv[0]);
-			return 0;
+	}
+	return NULL;
+}
+
+static const char *exit_kind_name(int kind)
+{
+	long long val = kind;
+	const char *name = exit_kind_lookup(NULL, &val);
+
+	return name ? name : "unknown";
+}
+
+/* 错误类退出（kind >= SCX_EXIT_ERROR）；查不到内核定义时按错误处理 */
+static bool exit_kind_is_error(int kind)
+{
+	long long err_kind;
+
+	return !exit_kind_lookup("SCX_EXIT_ERROR", &err_kind) || kind >= err_kind;
+}
+
+static const char *dsq_name(int dsq_id)
+{
+	if (dsq_id == DSQ_LATENCY)
+		return "latency";
+	if (dsq_id >= DSQ(KUN) && dsq_id <= DSQ(QIAN))
+		return gua_names[dsq_id - 1];
+	return "?";
+}
+
+/* 在 <out_dir>/ejections.log 追加一行事件记录（卸载、看门狗告警、重新加载） */
+static void log_event(const char *out_dir, const char *event, const char *detail, const char *profile)
+{
+	char path[256], stamp[32];
+	time_t now = time(NULL);
+	struct tm tm;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", out_dir, EVENT_LOG_NAME);
+	f = fopen(path, "a");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return;
+	}
+	localtime_r(&now, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+	fprintf(f, "%s event=%s profile=%s %s\n", stamp, event, profile, detail);
+	fclose(f);
+}
+
+enum run_result {
+	RUN_STOPPED = 0, /* 收到 SIGINT/SIGTERM，正常卸载 */
+	RUN_RESTART,     /* 退出码要求重启（SCX_ECODE_ACT_RESTART），等待最短退避后按原配置重新加载 */
+	RUN_EJECTED,     /* 错误导致的卸载，supervise 模式下退避后重新加载 */
+	RUN_UNLOADED,    /* 被 sysrq 或 BPF 主动卸载，不重新加载 */
+	RUN_FAILED,      /* 加载或挂载失败 */
+};
+
+/* 报告被卸载的原因并记录到事件日志，返回之后的处理方式 */
+static enum run_result report_exit(struct sched_bpf *skel, const char *out_dir, const struct named_profile *profile)
+{
+	struct user_exit_info *uei = &skel->data->uei;
+	char detail[UEI_REASON_LEN + UEI_MSG_LEN + 64], msg[UEI_MSG_LEN];
+	long long ecode = UEI_REPORT(skel, uei);
+
+	/* 事件日志一行一条，msg 中的换行替换为空格 */
+	snprintf(msg, sizeof(msg), "%s", uei->msg);
+	for (char *c = msg; *c; c++) {
+		if (*c == '\n')
+			*c = ' ';
+	}
+	snprintf(detail, sizeof(detail), "kind=%s code=%#llx reason=\"%.*s\" msg=\"%s\"",
+		exit_kind_name(uei->kind), ecode, UEI_REASON_LEN, uei->reason, msg);
+	log_event(out_dir, "ejected", detail, profile->name);
+
+	if (UEI_ECODE_RESTART(ecode))
+		return RUN_RESTART;
+	return exit_kind_is_error(uei->kind) ? RUN_EJECTED : RUN_UNLOADED;
+}
+
+/*
+ * 看门狗：每秒读取 BPF 维护的 DSQ 健康状态。
+ * 任一 DSQ 的排队时长超过 timeout_ms 的一半，或有任务排队而分派计数持续不增长，即视为降级，
+ * 在内核因超时卸载调度器之前给出告警。
+ */
+struct watchdog {
+	uint64_t interval_max_wait[NR_HEALTH_DSQ]; /* 本采样周期内的最大排队时长 */
+	uint64_t last_dispatched;
+	uint64_t last_ctx_full;                    /* task_ctx_map 插入失败计数 */
+	long long progress_ns;                     /* 最近一次观察到分派进展的时间 */
+	bool degraded;
+	char cause[128];
+};
+
+/* 返回 true 表示本次刚进入降级状态 */
+static bool watchdog_check(struct sched_bpf *skel, struct watchdog *wd, int timeout_ms, long long now_ns)
+{
+	uint64_t limit_ns = (uint64_t)(timeout_ms ? timeout_ms : TIMEOUT_MS_KERNEL_DEFAULT) * 1000000ULL / 2;
+	uint64_t stats[NR_STATS];
+	uint64_t worst_wait = 0, queued = 0, ctx_full = 0;
+	int worst_dsq = 0;
+	char *cause = wd->cause;
+	size_t len = sizeof(wd->cause);
+
+	for (int dsq = DSQ(KUN); dsq < NR_HEALTH_DSQ; dsq++) {
+		/* 原子交换取走并清零，BPF 侧在读与清零之间记录的最大值不会丢失 */
+		uint64_t max_wait = __atomic_exchange_n(&skel->bss->dsq_max_wait_ns[dsq], 0, __ATOMIC_SEQ_CST);
+		uint64_t wait = skel->bss->dsq_head_wait_ns[dsq];
+
+		if (max_wait > wait)
+			wait = max_wait;
+		if (wait > wd->interval_max_wait[dsq])
+			wd->interval_max_wait[dsq] = wait;
+		if (wait > worst_wait) {
+			worst_wait = wait;
+			worst_dsq = dsq;
 		}
+		queued += skel->bss->dsq_queued[dsq];
 	}
 
-	libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
-	libbpf_set_print(libbpf_print_fn);
+	if (read_stats(skel, stats) == 0) {
+		if (stats[STAT_DISPATCH_TASKS] != wd->last_dispatched || !queued || !wd->progress_ns)
+			wd->progress_ns = now_ns;
+		wd->last_dispatched = stats[STAT_DISPATCH_TASKS];
+		ctx_full = stats[STAT_TASK_CTX_FULL] - wd->last_ctx_full;
+		wd->last_ctx_full = stats[STAT_TASK_CTX_FULL];
+	}
 
-	if (bump_memlock_rlimit()) {
-		fprintf(stderr, "Failed to increase RLIMIT_MEMLOCK: %s\n", strerror(errno));
-		return 1;
+	cause[0] = '\0';
+	if (worst_wait > limit_ns)
+		snprintf(cause, len, "dsq=%s wait=%llums limit=%llums", dsq_name(worst_dsq),
+			(unsigned long long)(worst_wait / 1000000), (unsigned long long)(limit_ns / 1000000));
+	else if (now_ns - wd->progress_ns >= WATCHDOG_STALL_SEC * 1000000000LL)
+		snprintf(cause, len, "no dispatch progress for %llds with %llu queued",
+			(now_ns - wd->progress_ns) / 1000000000LL, (unsigned long long)queued);
+	else if (ctx_full)
+		snprintf(cause, len, "task_ctx_map full, %llu tasks unclassified", (unsigned long long)ctx_full);
+
+	if (!cause[0]) {
+		if (wd->degraded)
+			fprintf(stderr, "Watchdog: recovered\n");
+		wd->degraded = false;
+		return false;
 	}
+	if (wd->degraded)
+		return false;
 
-	signal(SIGINT, handle_signal);
-	signal(SIGTERM, handle_signal);
+	fprintf(stderr, "Watchdog: degraded, %s\n", cause);
+	wd->degraded = true;
+	return true;
+}
+
+/* 按采样周期输出各 DSQ 的最大排队时长 */
+static void print_dsq_wait(struct watchdog *wd)
+{
+	printf("dsq max wait/interval (ms):");
+	for (int dsq = DSQ(KUN); dsq < NR_HEALTH_DSQ; dsq++)
+		printf(" %s=%.1f", dsq_name(dsq), wd->interval_max_wait[dsq] / 1e6);
+	printf("%s\n", wd->degraded ? " [degraded]" : "");
+	fflush(stdout);
+	memset(wd->interval_max_wait, 0, sizeof(wd->interval_max_wait));
+}
+
+static int parse_output_format(const char *name)
+{
+	for (size_t i = 0; i < sizeof(output_format_names) / sizeof(output_format_names[0]); i++) {
+		if (!strcmp(name, output_format_names[i]))
+			return i;
+	}
+	return -1;
+}
+
+static void usage(FILE *f, const char *prog)
+{
+	fprintf(f, "Usage: %s [-o out_dir] [-i interval_ms] [--format bin|json|csv|both|all]\n"
+		   "          [--keyframe-every n]\n"
+		   "          [--cache-hot-us us] [--sticky-max-queued 0-4096] [--cgroup-bw]\n"
+		   "          [--profile name] [--latency PID|COMM[:slice_us[:period_us]]]...\n"
+		   "          [--latency-cap pct] [--dispatch-batch n] [--dispatch-budget-us us]\n"
+		   "          [--timeout-ms ms] [--supervise]\n"
+		   "Profiles:\n", prog);
+	list_profiles(f);
+	fprintf(f, "Runtime commands on stdin: profile [name], stats\n");
+}
+
+/* cpu.max 限流需要构建与运行内核都支持 cgroup_set_bandwidth（6.17+） */
+static bool cgroup_bw_supported(void)
+{
+#ifdef HAVE_CGROUP_BW
+	return kernel_has_ops_member("cgroup_set_bandwidth");
+#else
+	return false;
+#endif
+}
+
+/* 加载器配置（命令行解析结果），supervise 重新加载时沿用 */
+struct loader_opts {
+	const char *out_dir;
+	int interval_ms;
+	int cache_hot_us;
+	int sticky_max_queued;
+	int cgroup_bw;
+	int latency_cap_pct;
+	int dispatch_batch;
+	int dispatch_budget_us;
+	int timeout_ms;
+	bool supervise;
+	struct latency_spec latency_specs[MAX_LATENCY_SPECS];
+	size_t nr_latency_specs;
+	const struct named_profile *profile;
+	enum output_format fmt;
+	int keyframe_every;
+};
+
+/*
+ * 加载、挂载并运行调度器，直到收到退出信号或被内核卸载。
+ * fallback 时使用安全配置：balanced 方案、不限流、不批量分派、不启用延迟类。
+ */
+static enum run_result run_scheduler(const struct loader_opts *opt, bool fallback, struct snap_writer *snap)
+{
+	const struct named_profile *profile = fallback ? &profiles[0] : opt->profile;
+	int dispatch_batch = fallback ? 1 : opt->dispatch_batch;
+	size_t nr_latency_specs = fallback ? 0 : opt->nr_latency_specs;
+	enum run_result result = RUN_FAILED;
+	struct sched_bpf *skel;
+	struct watchdog wd = {0};
+	int err;
 
 	skel = sched_bpf__open();
 	if (!skel) {
 		fprintf(stderr, "Failed to open BPF skeleton\n");
-		return 1;
+		return RUN_FAILED;
 	}
 
+	/* struct_ops 字段只能在 load 之前设置（批量上限由 BPF 侧自行限制，与 dispatch_max_batch 无关） */
+	skel->struct_ops.ops->timeout_ms = opt->timeout_ms;
+#ifdef HAVE_CGROUP_BW
+	if (!cgroup_bw_supported())
+		skel->struct_ops.ops->cgroup_set_bandwidth = NULL;
+#endif
+
 	err = sched_bpf__load(skel);
 	if (err) {
 		fprintf(stderr, "Failed to load and verify BPF skeleton: %d\n", err);
 		goto cleanup;
 	}
 
-	err = sched_bpf__attach(skel);
-	if (err) {
-		fprintf(stderr, "Failed to attach BPF skeleton: %d\n", err);
-		goto cleanup;
-	}
-
-	/* 初始化系统配置并写入BPF map */
+	/* 初始化系统配置并写入BPF map（在 attach 之前，调度器一启用即可用） */
 	struct sys_config config = {0};
 	init_sys_config(&config);
+	config.cache_hot_us = opt->cache_hot_us;
+	config.sticky_max_queued = opt->sticky_max_queued;
+	config.cgroup_bw = fallback ? 0 : opt->cgroup_bw;
+	config.latency_cap_pct = opt->latency_cap_pct;
+	config.dispatch_batch = dispatch_batch;
+	config.dispatch_budget_us = opt->dispatch_budget_us;
+	if (refresh_cpu_topology(skel, &config, true) < 0) {
+		fprintf(stderr, "Warning: Failed to write cpu topology to BPF map\n");
+	}
 	if (write_sys_config_to_bpf(skel, &config) != 0) {
 		fprintf(stderr, "Warning: Failed to write system config to BPF map\n");
 	}
-
-	printf("sched_ext scheduler loaded. Press Ctrl+C to exit.\n");
-	printf("Output dir: %s, interval: %dms, format: %s\n",
-		out_dir,
-		interval_ms,
-		fmt == OUTPUT_JSON ? "json" : (fmt == OUTPUT_CSV ? "csv" : "both"));
-
-	if (ensure_dir_exists(out_dir) != 0) {
-		err = 1;
+	if (write_profile_to_bpf(skel, profile) != 0) {
+		fprintf(stderr, "Warning: Failed to write policy profile to BPF map\n");
+	}
+	err = sched_bpf__attach(skel);
+	if (err) {
+		fprintf(stderr, "Failed to attach BPF skeleton: %d\n", err);
 		goto cleanup;
 	}
 
-	int task_ctx_fd = bpf_map__fd(skel->maps.task_ctx_map);
-	if (task_ctx_fd < 0) {
-		fprintf(stderr, "Failed to get task_ctx_map fd: %d\n", task_ctx_fd);
-		err = 1;
+	printf("sched_ext scheduler loaded%s. Press Ctrl+C to exit.\n", fallback ? " (fallback)" : "");
+	printf("Output dir: %s, interval: %dms, format: %s, profile: %s\n",
+		opt->out_dir,
+		opt->interval_ms,
+		output_format_names[opt->fmt],
+		profile->name);
+
+	if (!skel->links.dump_task_snapshot) {
+		fprintf(stderr, "Task iterator is not attached\n");
 		goto cleanup;
 	}
 
 	struct timespec ts;
 	long long next_sample_ns = 0;
+	struct pollfd cmd_pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+	char cmd_line[256];
 
+	result = RUN_STOPPED;
 	while (!exiting) {
+		/* 被内核卸载：报告原因并交给调用者决定是否重新加载 */
+		if (UEI_EXITED(skel, uei)) {
+			result = report_exit(skel, opt->out_dir, profile);
+			break;
+		}
+
 		clock_gettime(CLOCK_MONOTONIC, &ts);
 		long long now_ns = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 		if (next_sample_ns == 0)
 			next_sample_ns = now_ns;
 
-		if (now_ns >= next_sample_ns) {
-			long long ts_sec = (long long)time(NULL);
+		/* 一次迭代器读取同时供采样输出与延迟类成员同步使用 */
+		bool sample_due = now_ns >= next_sample_ns;
+		struct task_snapshot *recs = NULL;
+		ssize_t nr_recs = -1;
+
+		if (sample_due || nr_latency_specs)
+			nr_recs = read_task_snapshots(skel, &recs);
+
+		if (sample_due) {
+			struct timespec rt;
+			long long ts_sec;
 			char json_path[256];
 			char csv_path[256];
+			size_t nr = nr_recs > 0 ? nr_recs : 0;
 
-			if (fmt == OUTPUT_JSON || fmt == OUTPUT_BOTH) {
-				snprintf(json_path, sizeof(json_path), "%s/task_ctx_%lld.json", out_dir, ts_sec);
-				dump_task_ctx_json(task_ctx_fd, json_path, ts_sec);
+			/* 各格式使用同一个时间戳，快照文件与 JSON/CSV 可按秒对应 */
+			clock_gettime(CLOCK_REALTIME, &rt);
+			ts_sec = rt.tv_sec;
+			if (OUTPUT_HAS_BIN(opt->fmt))
+				snap_writer_append(snap, (int64_t)rt.tv_sec * 1000000000LL + rt.tv_nsec, recs, nr);
+			if (OUTPUT_HAS_JSON(opt->fmt)) {
+				snprintf(json_path, sizeof(json_path), "%s/task_ctx_%lld.json", opt->out_dir, ts_sec);
+				dump_task_ctx_json(recs, nr, json_path, ts_sec);
 			}
-			if (fmt == OUTPUT_CSV || fmt == OUTPUT_BOTH) {
-				snprintf(csv_path, sizeof(csv_path), "%s/task_ctx_%lld.csv", out_dir, ts_sec);
-				dump_task_ctx_csv(task_ctx_fd, csv_path, ts_sec);
+			if (OUTPUT_HAS_CSV(opt->fmt)) {
+				snprintf(csv_path, sizeof(csv_path), "%s/task_ctx_%lld.csv", opt->out_dir, ts_sec);
+				dump_task_ctx_csv(recs, nr, csv_path, ts_sec);
+			}
+			print_stats(skel);
+			print_dsq_wait(&wd);
+			print_cgroup_stats(skel);
+			print_latency_stats(skel);
+			next_sample_ns = now_ns + (long long)opt->interval_ms * 1000000LL;
+		}
+
+		/* 看门狗：排队过久或有任务排队却没有分派进展时告警；supervise 模式下切换到安全方案 */
+		if (watchdog_check(skel, &wd, opt->timeout_ms, now_ns)) {
+			log_event(opt->out_dir, "watchdog", wd.cause, profile->name);
+			if (opt->supervise && profile != &profiles[0] && write_profile_to_bpf(skel, &profiles[0]) == 0) {
+				log_event(opt->out_dir, "fallback", "switched to balanced", profile->name);
+				profile = &profiles[0];
 			}
-			next_sample_ns = now_ns + (long long)interval_ms * 1000000LL;
 		}
 
-		sleep(1);
+		/* CPU 热插拔：在线 CPU 变化时刷新拓扑 map 与性能/能效核心数 */
+		if (refresh_cpu_topology(skel, &config, false) > 0)
+			write_sys_config_to_bpf(skel, &config);
+
+		/* 刻漏：按配置同步延迟类成员（新线程准入、已退出线程移除）；读取快照失败时保持现状 */
+		if (nr_recs >= 0)
+			sync_latency_members(skel, opt->latency_specs, nr_latency_specs, recs, nr_recs,
+					     config.latency_cap_pct, config.num_perf_cpus + config.num_eff_cpus);
+
+		/* 等待 1 秒，期间处理标准输入上的运行时命令（后台运行时不读终端，避免被 SIGTTIN 停住） */
+		bool cmd_ready = cmd_pfd.fd >= 0 && stdin_in_foreground();
+
+		if (cmd_ready && poll(&cmd_pfd, 1, 1000) > 0) {
+			if (fgets(cmd_line, sizeof(cmd_line), stdin))
+				handle_command(skel, cmd_line, &profile);
+			else
+				cmd_pfd.fd = -1; /* 标准输入已关闭，不再监听 */
+		} else if (!cmd_ready) {
+			sleep(1);
+		}
 	}
 
 cleanup:
 	sched_bpf__destroy(skel);
-	return err != 0;
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	struct loader_opts opt = {
+		.out_dir = "./scx",
+		.interval_ms = 10000,
+		.cache_hot_us = 2000,
+		.sticky_max_queued = STICKY_MAX_QUEUED_DEFAULT,
+		.latency_cap_pct = LAT_CAP_PCT_DEFAULT,
+		.dispatch_batch = DISPATCH_BATCH_DEFAULT,
+		.dispatch_budget_us = DISPATCH_BUDGET_US_DEFAULT,
+		.profile = &profiles[0],
+		.fmt = OUTPUT_BIN,
+		.keyframe_every = SNAP_KEYFRAME_DEFAULT,
+	};
+	struct snap_writer snap = {0};
+	enum run_result res;
+	int backoff = SUPERVISE_BACKOFF_MIN;
+	int quick_restarts = 0;
+	bool fallback = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			opt.out_dir = argv[++i];
+			continue;
+		}
+		if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+			opt.interval_ms = atoi(argv[++i]);
+			if (opt.interval_ms <= 0)
+				opt.interval_ms = 1000;
+			continue;
+		}
+		if (!strcmp(argv[i], "--cache-hot-us") && i + 1 < argc) {
+			opt.cache_hot_us = atoi(argv[++i]);
+			if (opt.cache_hot_us <= 0)
+				opt.cache_hot_us = 2000;
+			continue;
+		}
+		if (!strcmp(argv[i], "--sticky-max-queued") && i + 1 < argc) {
+			char *end;
+			long n = strtol(argv[++i], &end, 10);
+
+			/* 0 表示只在上次 CPU 本地队列为空时才留下 */
+			if (end == argv[i] || *end || n < 0 || n > STICKY_MAX_QUEUED_MAX) {
+				fprintf(stderr, "Invalid --sticky-max-queued: %s (0-%d)\n",
+					argv[i], STICKY_MAX_QUEUED_MAX);
+				usage(stderr, argv[0]);
+				return 1;
+			}
+			opt.sticky_max_queued = n;
+			continue;
+		}
+		if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+			opt.profile = find_profile(argv[++i]);
+			if (!opt.profile) {
+				fprintf(stderr, "Unknown profile: %s\n", argv[i]);
+				list_profiles(stderr);
+				return 1;
+			}
+			continue;
+		}
+		if (!strcmp(argv[i], "--latency") && i + 1 < argc) {
+			if (opt.nr_latency_specs >= MAX_LATENCY_SPECS ||
+			    parse_latency_spec(argv[++i], &opt.latency_specs[opt.nr_latency_specs]) != 0) {
+				fprintf(stderr, "Invalid latency spec: %s (PID|COMM[:slice_us[:period_us]])\n", argv[i]);
+				return 1;
+			}
+			opt.nr_latency_specs++;
+			continue;
+		}
+		if (!strcmp(argv[i], "--latency-cap") && i + 1 < argc) {
+			opt.latency_cap_pct = atoi(argv[++i]);
+			if (opt.latency_cap_pct <= 0 || opt.latency_cap_pct > 100)
+				opt.latency_cap_pct = LAT_CAP_PCT_DEFAULT;
+			continue;
+		}
+		if (!strcmp(argv[i], "--dispatch-batch") && i + 1 < argc) {
+			opt.dispatch_batch = atoi(argv[++i]);
+			if (opt.dispatch_batch <= 0)
+				opt.dispatch_batch = DISPATCH_BATCH_DEFAULT;
+			if (opt.dispatch_batch > DISPATCH_BATCH_MAX)
+				opt.dispatch_batch = DISPATCH_BATCH_MAX;
+			continue;
+		}
+		if (!strcmp(argv[i], "--dispatch-budget-us") && i + 1 < argc) {
+			opt.dispatch_budget_us = atoi(argv[++i]);
+			if (opt.dispatch_budget_us <= 0)
+				opt.dispatch_budget_us = DISPATCH_BUDGET_US_DEFAULT;
+			continue;
+		}
+		if (!strcmp(argv[i], "--timeout-ms") && i + 1 < argc) {
+			opt.timeout_ms = atoi(argv[++i]);
+			if (opt.timeout_ms < 0 || opt.timeout_ms > TIMEOUT_MS_MAX)
+				opt.timeout_ms = 0;
+			continue;
+		}
+		if (!strcmp(argv[i], "--supervise")) {
+			opt.supervise = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "--cgroup-bw")) {
+			opt.cgroup_bw = 1;
+			continue;
+		}
+		if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+			int fmt = parse_output_format(argv[++i]);
+
+			if (fmt < 0) {
+				fprintf(stderr, "Unknown format: %s\n", argv[i]);
+				usage(stderr, argv[0]);
+				return 1;
+			}
+			opt.fmt = fmt;
+			continue;
+		}
+		if (!strcmp(argv[i], "--keyframe-every") && i + 1 < argc) {
+			opt.keyframe_every = atoi(argv[++i]);
+			if (opt.keyframe_every <= 0)
+				opt.keyframe_every = SNAP_KEYFRAME_DEFAULT;
+			continue;
+		}
+		if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+			usage(stdout, argv[0]);
+			return 0;
+		}
+	}
+
+	libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
+	libbpf_set_print(libbpf_print_fn);
+
+	if (bump_memlock_rlimit()) {
+		fprintf(stderr, "Failed to increase RLIMIT_MEMLOCK: %s\n", strerror(errno));
+		return 1;
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	if (ensure_dir_exists(opt.out_dir) != 0)
+		return 1;
+
+	if (opt.cgroup_bw && !cgroup_bw_supported()) {
+		fprintf(stderr, "Warning: --cgroup-bw needs cgroup_set_bandwidth (kernel 6.17+), ignored\n");
+		opt.cgroup_bw = 0;
+	}
+
+	if (OUTPUT_HAS_BIN(opt.fmt)) {
+		char snap_path[256];
+
+		snprintf(snap_path, sizeof(snap_path), "%s/task_ctx.scxs", opt.out_dir);
+		if (snap_writer_open(&snap, snap_path, opt.keyframe_every) != 0)
+			return 1;
+		printf("Snapshot file: %s (keyframe every %d samples)\n", snap_path, opt.keyframe_every);
+	}
+
+	/*
+	 * 退出码带 SCX_ECODE_ACT_RESTART 时（不论是否 supervise）等待最短退避后按当前配置重新加载；
+	 * 连续 RESTART_QUICK_MAX 次仍要求重启，说明触发条件还在，不再原样重试：
+	 * supervise 模式下转入错误卸载的退避路径，否则退出。
+	 * supervise 模式：因错误被卸载（或重新加载失败）后按指数退避重新加载，
+	 * 之后一直使用安全配置；平稳运行足够久后退避时间与重启计数复位。
+	 */
+	for (;;) {
+		time_t started = time(NULL);
+		char detail[128];
+
+		res = run_scheduler(&opt, fallback, &snap);
+		if (time(NULL) - started >= SUPERVISE_STABLE_SEC) {
+			backoff = SUPERVISE_BACKOFF_MIN;
+			quick_restarts = 0;
+		}
+		if (res == RUN_RESTART && !exiting) {
+			if (++quick_restarts <= RESTART_QUICK_MAX) {
+				snprintf(detail, sizeof(detail), "requested by exit code, reloading in %ds (%d/%d)",
+					 SUPERVISE_BACKOFF_MIN, quick_restarts, RESTART_QUICK_MAX);
+				fprintf(stderr, "Restart %s\n", detail);
+				log_event(opt.out_dir, "restart", detail,
+					  fallback ? profiles[0].name : opt.profile->name);
+				for (int i = 0; i < SUPERVISE_BACKOFF_MIN && !exiting; i++)
+					sleep(1);
+				if (exiting)
+					break;
+				continue;
+			}
+			fprintf(stderr, "Restart requested %d times in a row, giving up on immediate reloads\n",
+				RESTART_QUICK_MAX);
+			res = RUN_EJECTED;
+		}
+		if (res == RUN_STOPPED || res == RUN_UNLOADED || exiting || !opt.supervise)
+			break;
+
+		snprintf(detail, sizeof(detail), "%s, reloading with fallback config in %ds",
+			res == RUN_EJECTED ? "ejected" : "load failed", backoff);
+		fprintf(stderr, "Supervisor: %s\n", detail);
+		log_event(opt.out_dir, "restart", detail, fallback ? profiles[0].name : opt.profile->name);
+
+		for (int i = 0; i < backoff && !exiting; i++)
+			sleep(1);
+		if (exiting)
+			break;
+		backoff = backoff * 2 < SUPERVISE_BACKOFF_MAX ? backoff * 2 : SUPERVISE_BACKOFF_MAX;
+		fallback = true;
+	}
+
+	snap_writer_close(&snap);
+	return res != RUN_STOPPED;
 }
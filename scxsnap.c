@@ -0,0 +1,164 @@
+/*
+ * scxsnap：读取 sched 写出的 .scxs 任务快照文件，导出为 CSV / JSON。
+ *
+ *   scxsnap info FILE
+ *   scxsnap csv  FILE [--from sec] [--to sec] [--at sec]
+ *   scxsnap json FILE [--from sec] [--to sec] [--at sec]
+ *
+ * 时间均为 Unix 时间戳（秒），与 JSON 输出中的 timestamp 一致。
+ * json 每行输出一个快照对象（JSON Lines），格式与 sched --format json 的单个文件相同。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s info FILE\n"
+		"       %s csv|json FILE [--from sec] [--to sec] [--at sec]\n",
+		prog, prog);
+}
+
+static int cmd_info(const struct snap_reader *r)
+{
+	struct snap_state st = {0};
+	size_t frames = 0, max_tasks = 0;
+	int64_t first = 0, last = 0;
+	int ret;
+
+	snap_reader_seek(r, &st, -1);
+	while ((ret = snap_reader_next(r, &st)) > 0) {
+		if (!frames)
+			first = st.timestamp_ns;
+		last = st.timestamp_ns;
+		if (st.nr > max_tasks)
+			max_tasks = st.nr;
+		frames++;
+	}
+
+	printf("version:           %u\n", r->hdr->version);
+	printf("record size:       %u\n", r->hdr->record_size);
+	printf("keyframe interval: %u\n", r->hdr->keyframe_interval);
+	printf("file size:         %zu bytes\n", r->size);
+	printf("snapshots:         %zu (%zu keyframes)\n", frames, r->nr_index);
+	if (frames)
+		printf("time range:        %lld - %lld\n",
+		       (long long)(first / NSEC_PER_SEC), (long long)(last / NSEC_PER_SEC));
+	printf("max tasks:         %zu\n", max_tasks);
+
+	snap_state_free(&st);
+	return ret < 0 ? 1 : 0;
+}
+
+/* --at：回放到不晚于给定时间的最后一个快照并输出 */
+static int cmd_export_at(const struct snap_reader *r, bool json, int64_t at_ns)
+{
+	struct snap_state st = {0};
+	int64_t next_ns;
+	int ret = 0;
+
+	if (!json)
+		snap_write_csv_header(stdout);
+
+	snap_reader_seek(r, &st, at_ns);
+	while (snap_reader_peek(r, &st, &next_ns) && next_ns <= at_ns) {
+		ret = snap_reader_next(r, &st);
+		if (ret <= 0)
+			break;
+	}
+
+	if (ret < 0) {
+		fprintf(stderr, "Corrupt frame at offset %llu\n", (unsigned long long)st.off);
+	} else if (st.timestamp_ns > 0) {
+		if (json)
+			snap_write_json(stdout, st.timestamp_ns / NSEC_PER_SEC, st.recs, st.nr);
+		else
+			snap_write_csv_rows(stdout, st.timestamp_ns / NSEC_PER_SEC, st.recs, st.nr);
+	}
+
+	snap_state_free(&st);
+	return ret < 0 ? 1 : 0;
+}
+
+static int cmd_export(const struct snap_reader *r, bool json, int64_t from_ns, int64_t to_ns)
+{
+	struct snap_state st = {0};
+	int ret;
+
+	if (!json)
+		snap_write_csv_header(stdout);
+
+	/* 从不晚于起点的关键帧开始回放，之后的增量帧依次应用 */
+	snap_reader_seek(r, &st, from_ns);
+	while ((ret = snap_reader_next(r, &st)) > 0) {
+		long long ts_sec = st.timestamp_ns / NSEC_PER_SEC;
+
+		if (st.timestamp_ns < from_ns)
+			continue;
+		if (st.timestamp_ns > to_ns)
+			break;
+		if (json)
+			snap_write_json(stdout, ts_sec, st.recs, st.nr);
+		else
+			snap_write_csv_rows(stdout, ts_sec, st.recs, st.nr);
+	}
+
+	if (ret < 0)
+		fprintf(stderr, "Corrupt frame at offset %llu\n", (unsigned long long)st.off);
+	snap_state_free(&st);
+	return ret < 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct snap_reader r;
+	int64_t from_ns = -1, to_ns = INT64_MAX;
+	bool at = false;
+	int err;
+
+	if (argc < 3) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (int i = 3; i < argc; i++) {
+		if (!strcmp(argv[i], "--from") && i + 1 < argc) {
+			from_ns = atoll(argv[++i]) * NSEC_PER_SEC;
+			continue;
+		}
+		if (!strcmp(argv[i], "--to") && i + 1 < argc) {
+			/* 包含该秒内的所有快照 */
+			to_ns = (atoll(argv[++i]) + 1) * NSEC_PER_SEC - 1;
+			continue;
+		}
+		if (!strcmp(argv[i], "--at") && i + 1 < argc) {
+			from_ns = (atoll(argv[++i]) + 1) * NSEC_PER_SEC - 1;
+			at = true;
+			continue;
+		}
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (snap_reader_open(&r, argv[2]) != 0)
+		return 1;
+
+	if (!strcmp(argv[1], "info")) {
+		err = cmd_info(&r);
+	} else if (!strcmp(argv[1], "csv") || !strcmp(argv[1], "json")) {
+		bool json = !strcmp(argv[1], "json");
+
+		err = at ? cmd_export_at(&r, json, from_ns) : cmd_export(&r, json, from_ns, to_ns);
+	} else {
+		usage(argv[0]);
+		err = 1;
+	}
+
+	snap_reader_close(&r);
+	return err;
+}
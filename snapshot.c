@@ -0,0 +1,596 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+
+#define SNAP_ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+static uint64_t frame_size(const struct snap_frame_header *fh, uint32_t record_size)
+{
+	return sizeof(*fh) + (uint64_t)fh->nr_records * record_size +
+	       SNAP_ALIGN8((uint64_t)fh->nr_removed * sizeof(uint32_t));
+}
+
+static bool frame_valid(const struct snap_frame_header *fh, uint64_t off, uint64_t size, uint32_t record_size)
+{
+	if (fh->magic != SNAP_FRAME_MAGIC)
+		return false;
+	if (fh->type != SNAP_FRAME_KEY && fh->type != SNAP_FRAME_DELTA)
+		return false;
+	return off + frame_size(fh, record_size) <= size;
+}
+
+static int grow(void **buf, size_t *cap, size_t need, size_t elem)
+{
+	void *tmp;
+	size_t new_cap;
+
+	if (need <= *cap)
+		return 0;
+	new_cap = *cap ? *cap : 1024;
+	while (new_cap < need)
+		new_cap *= 2;
+	tmp = realloc(*buf, new_cap * elem);
+	if (!tmp)
+		return -1;
+	*buf = tmp;
+	*cap = new_cap;
+	return 0;
+}
+
+static int cmp_pid(const void *a, const void *b)
+{
+	const struct task_snapshot *ra = a, *rb = b;
+	if (ra->pid == rb->pid)
+		return 0;
+	return ra->pid < rb->pid ? -1 : 1;
+}
+
+/* ---------------------------------------------------------------- 写入端 */
+
+static char *idx_path(const char *path)
+{
+	size_t len = strlen(path);
+	char *p = malloc(len + 5);
+
+	if (p) {
+		memcpy(p, path, len);
+		memcpy(p + len, ".idx", 5);
+	}
+	return p;
+}
+
+/*
+ * 打开已有文件时扫描帧头找到最后一个完整帧（崩溃时尾部可能只写了一半），
+ * 截断掉不完整的部分并据此重写关键帧索引。写入端没有上一帧的任务集合，下一帧强制为关键帧。
+ */
+static int writer_recover(struct snap_writer *w, int fd, uint64_t size)
+{
+	struct snap_file_header hdr;
+	uint64_t off;
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+	    memcmp(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.version != SNAP_VERSION || hdr.record_size != sizeof(struct task_snapshot)) {
+		fprintf(stderr, "Existing file is not a compatible snapshot file\n");
+		return -1;
+	}
+
+	off = hdr.header_size;
+	while (off + sizeof(struct snap_frame_header) <= size) {
+		struct snap_frame_header fh;
+
+		if (pread(fd, &fh, sizeof(fh), off) != (ssize_t)sizeof(fh) ||
+		    !frame_valid(&fh, off, size, hdr.record_size))
+			break;
+		if (fh.type == SNAP_FRAME_KEY) {
+			struct snap_index_entry ent = { .timestamp_ns = fh.timestamp_ns, .offset = off };
+			fwrite(&ent, sizeof(ent), 1, w->idx);
+			w->last_keyframe_off = off;
+		}
+		off += frame_size(&fh, hdr.record_size);
+	}
+
+	if (off < size && ftruncate(fd, off) != 0) {
+		fprintf(stderr, "Failed to truncate partial frame: %s\n", strerror(errno));
+		return -1;
+	}
+	w->off = off;
+	return 0;
+}
+
+int snap_writer_open(struct snap_writer *w, const char *path, uint32_t keyframe_interval)
+{
+	struct stat st;
+	char *ipath;
+	int fd;
+
+	memset(w, 0, sizeof(*w));
+	w->keyframe_interval = keyframe_interval ? keyframe_interval : SNAP_KEYFRAME_DEFAULT;
+	w->need_keyframe = true;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	ipath = idx_path(path);
+	w->idx = ipath ? fopen(ipath, "wb") : NULL;
+	free(ipath);
+	if (!w->idx) {
+		fprintf(stderr, "Failed to open index for %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size > 0) {
+		if (writer_recover(w, fd, st.st_size) != 0)
+			goto err;
+	} else {
+		struct snap_file_header hdr = {
+			.version = SNAP_VERSION,
+			.header_size = sizeof(hdr),
+			.record_size = sizeof(struct task_snapshot),
+			.keyframe_interval = w->keyframe_interval,
+		};
+		struct timespec ts;
+
+		memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+		clock_gettime(CLOCK_REALTIME, &ts);
+		hdr.created_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+		if (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+			fprintf(stderr, "Failed to write snapshot header: %s\n", strerror(errno));
+			goto err;
+		}
+		w->off = sizeof(hdr);
+	}
+
+	w->f = fdopen(fd, "r+b");
+	if (!w->f || fseeko(w->f, w->off, SEEK_SET) != 0)
+		goto err;
+	fflush(w->idx);
+	return 0;
+
+err:
+	if (w->f)
+		fclose(w->f);
+	else
+		close(fd);
+	fclose(w->idx);
+	memset(w, 0, sizeof(*w));
+	return -1;
+}
+
+/* task_snapshot 没有填充字节，整条记录比较即可覆盖所有导出字段（运行时间、切换次数、迁移等） */
+_Static_assert(sizeof(struct task_snapshot) ==
+	       offsetof(struct task_snapshot, partner_pid) + sizeof(uint32_t),
+	       "task_snapshot must not contain padding");
+
+static bool task_changed(const struct task_snapshot *a, const struct task_snapshot *b)
+{
+	return memcmp(a, b, sizeof(*a)) != 0;
+}
+
+long snap_writer_append(struct snap_writer *w, int64_t timestamp_ns, struct task_snapshot *recs, size_t nr)
+{
+	static const uint8_t pad[8];
+	struct snap_frame_header fh = {
+		.magic = SNAP_FRAME_MAGIC,
+		.timestamp_ns = timestamp_ns,
+	};
+	const struct task_snapshot *out = recs;
+	size_t nr_delta = 0, nr_removed = 0, i = 0, j = 0;
+	uint64_t len, removed_len;
+
+	if (!w->f)
+		return -1;
+
+	qsort(recs, nr, sizeof(*recs), cmp_pid);
+
+	if (w->need_keyframe || w->frames_since_key >= w->keyframe_interval) {
+		fh.type = SNAP_FRAME_KEY;
+		fh.nr_records = nr;
+		fh.prev_keyframe_off = w->off;
+	} else {
+		/* 按 pid 归并：新出现或任一字段变化的任务写入增量，消失的任务记为已移除 */
+		if (grow((void **)&w->delta, &w->cap_delta, nr, sizeof(*w->delta)) ||
+		    grow((void **)&w->removed, &w->cap_removed, w->nr_prev, sizeof(*w->removed)))
+			return -1;
+		while (i < nr || j < w->nr_prev) {
+			if (j >= w->nr_prev || (i < nr && recs[i].pid < w->prev[j].pid)) {
+				w->delta[nr_delta++] = recs[i++];
+			} else if (i >= nr || w->prev[j].pid < recs[i].pid) {
+				w->removed[nr_removed++] = w->prev[j++].pid;
+			} else {
+				if (task_changed(&recs[i], &w->prev[j]))
+					w->delta[nr_delta++] = recs[i];
+				i++;
+				j++;
+			}
+		}
+		fh.type = SNAP_FRAME_DELTA;
+		fh.nr_records = nr_delta;
+		fh.nr_removed = nr_removed;
+		fh.prev_keyframe_off = w->last_keyframe_off;
+		out = w->delta;
+	}
+
+	removed_len = (uint64_t)fh.nr_removed * sizeof(uint32_t);
+	if (fwrite(&fh, sizeof(fh), 1, w->f) != 1 ||
+	    (fh.nr_records && fwrite(out, sizeof(*out), fh.nr_records, w->f) != fh.nr_records) ||
+	    (fh.nr_removed && fwrite(w->removed, sizeof(uint32_t), fh.nr_removed, w->f) != fh.nr_removed) ||
+	    (SNAP_ALIGN8(removed_len) != removed_len &&
+	     fwrite(pad, SNAP_ALIGN8(removed_len) - removed_len, 1, w->f) != 1) ||
+	    fflush(w->f) != 0) {
+		fprintf(stderr, "Failed to append snapshot frame: %s\n", strerror(errno));
+		return -1;
+	}
+
+	len = frame_size(&fh, sizeof(struct task_snapshot));
+	if (fh.type == SNAP_FRAME_KEY) {
+		struct snap_index_entry ent = { .timestamp_ns = timestamp_ns, .offset = w->off };
+
+		fwrite(&ent, sizeof(ent), 1, w->idx);
+		fflush(w->idx);
+		w->last_keyframe_off = w->off;
+		w->frames_since_key = 0;
+		w->need_keyframe = false;
+	}
+	w->frames_since_key++;
+	w->off += len;
+
+	/* 保存本帧的完整任务集合，供下一帧计算增量 */
+	if (grow((void **)&w->prev, &w->cap_prev, nr, sizeof(*w->prev))) {
+		w->need_keyframe = true;
+		w->nr_prev = 0;
+		return len;
+	}
+	memcpy(w->prev, recs, nr * sizeof(*recs));
+	w->nr_prev = nr;
+	return len;
+}
+
+void snap_writer_close(struct snap_writer *w)
+{
+	if (w->f)
+		fclose(w->f);
+	if (w->idx)
+		fclose(w->idx);
+	free(w->prev);
+	free(w->delta);
+	free(w->removed);
+	memset(w, 0, sizeof(*w));
+}
+
+/* ---------------------------------------------------------------- 读取端 */
+
+static int index_append(struct snap_reader *r, size_t *cap, int64_t ts, uint64_t off)
+{
+	if (grow((void **)&r->index, cap, r->nr_index + 1, sizeof(*r->index)))
+		return -1;
+	r->index[r->nr_index].timestamp_ns = ts;
+	r->index[r->nr_index].offset = off;
+	r->nr_index++;
+	return 0;
+}
+
+/* 优先读取 .idx；缺失或与数据文件不一致时按帧头扫描重建 */
+static int reader_load_index(struct snap_reader *r, const char *path)
+{
+	char *ipath = idx_path(path);
+	FILE *f = ipath ? fopen(ipath, "rb") : NULL;
+	size_t cap = 0;
+	struct snap_index_entry ent;
+	uint64_t off;
+
+	free(ipath);
+	if (f) {
+		bool ok = true;
+
+		while (fread(&ent, sizeof(ent), 1, f) == 1) {
+			struct snap_frame_header fh;
+
+			if (ent.offset + sizeof(fh) > r->size) {
+				ok = false;
+				break;
+			}
+			memcpy(&fh, r->base + ent.offset, sizeof(fh));
+			if (!frame_valid(&fh, ent.offset, r->size, r->hdr->record_size) || fh.type != SNAP_FRAME_KEY) {
+				ok = false;
+				break;
+			}
+			if (index_append(r, &cap, ent.timestamp_ns, ent.offset)) {
+				ok = false;
+				break;
+			}
+		}
+		fclose(f);
+		if (ok && r->nr_index > 0)
+			return 0;
+		r->nr_index = 0;
+	}
+
+	off = r->hdr->header_size;
+	while (off + sizeof(struct snap_frame_header) <= r->size) {
+		struct snap_frame_header fh;
+
+		memcpy(&fh, r->base + off, sizeof(fh));
+		if (!frame_valid(&fh, off, r->size, r->hdr->record_size))
+			break;
+		if (fh.type == SNAP_FRAME_KEY && index_append(r, &cap, fh.timestamp_ns, off))
+			return -1;
+		off += frame_size(&fh, r->hdr->record_size);
+	}
+	return 0;
+}
+
+int snap_reader_open(struct snap_reader *r, const char *path)
+{
+	struct stat st;
+	void *base;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = open(path, O_RDONLY);
+	if (r->fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(r->fd, &st) != 0 || (size_t)st.st_size < sizeof(struct snap_file_header)) {
+		fprintf(stderr, "%s: file too small\n", path);
+		goto err;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Failed to mmap %s: %s\n", path, strerror(errno));
+		goto err;
+	}
+	r->base = base;
+	r->size = st.st_size;
+	r->hdr = base;
+
+	if (memcmp(r->hdr->magic, SNAP_MAGIC, sizeof(r->hdr->magic)) != 0 ||
+	    r->hdr->version != SNAP_VERSION ||
+	    r->hdr->record_size < sizeof(struct task_snapshot) ||
+	    r->hdr->header_size < sizeof(struct snap_file_header)) {
+		fprintf(stderr, "%s: not a snapshot file (or unsupported version)\n", path);
+		goto err;
+	}
+
+	if (reader_load_index(r, path) != 0)
+		goto err;
+	return 0;
+
+err:
+	snap_reader_close(r);
+	return -1;
+}
+
+void snap_reader_close(struct snap_reader *r)
+{
+	if (r->base)
+		munmap((void *)r->base, r->size);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r->index);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+void snap_reader_seek(const struct snap_reader *r, struct snap_state *st, int64_t timestamp_ns)
+{
+	size_t lo = 0, hi = r->nr_index;
+
+	st->nr = 0;
+	st->timestamp_ns = 0;
+	st->off = r->hdr->header_size;
+	if (timestamp_ns < 0 || r->nr_index == 0)
+		return;
+
+	/* 二分查找时间戳不晚于 timestamp_ns 的最后一个关键帧 */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (r->index[mid].timestamp_ns <= timestamp_ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo > 0)
+		st->off = r->index[lo - 1].offset;
+}
+
+static void read_record(const struct snap_reader *r, const uint8_t *p, size_t i, struct task_snapshot *out)
+{
+	memcpy(out, p + i * r->hdr->record_size, sizeof(*out));
+}
+
+int snap_reader_next(const struct snap_reader *r, struct snap_state *st)
+{
+	struct snap_frame_header fh;
+	const uint8_t *recs, *removed_base;
+	size_t i = 0, j = 0, k = 0, n = 0;
+
+	if (st->off + sizeof(fh) > r->size)
+		return 0;
+	memcpy(&fh, r->base + st->off, sizeof(fh));
+	if (!frame_valid(&fh, st->off, r->size, r->hdr->record_size))
+		return fh.magic == SNAP_FRAME_MAGIC ? 0 : -1; /* 尾部未写完的帧视为结束 */
+
+	recs = r->base + st->off + sizeof(fh);
+	removed_base = recs + (size_t)fh.nr_records * r->hdr->record_size;
+
+	if (fh.type == SNAP_FRAME_KEY) {
+		if (grow((void **)&st->recs, &st->cap, fh.nr_records, sizeof(*st->recs)))
+			return -1;
+		for (i = 0; i < fh.nr_records; i++)
+			read_record(r, recs, i, &st->recs[i]);
+		st->nr = fh.nr_records;
+	} else {
+		/* 归并：上一状态 ∪ 增量记录 − 已移除的 pid，三者均按 pid 有序 */
+		if (grow((void **)&st->scratch, &st->cap_scratch, st->nr + fh.nr_records, sizeof(*st->scratch)))
+			return -1;
+		while (i < st->nr || j < fh.nr_records) {
+			struct task_snapshot d;
+			uint32_t rm;
+
+			if (j < fh.nr_records)
+				read_record(r, recs, j, &d);
+			if (j >= fh.nr_records || (i < st->nr && st->recs[i].pid < d.pid)) {
+				/* 跳过已移除的任务 */
+				while (k < fh.nr_removed) {
+					memcpy(&rm, removed_base + k * sizeof(rm), sizeof(rm));
+					if (rm >= st->recs[i].pid)
+						break;
+					k++;
+				}
+				if (k < fh.nr_removed && rm == st->recs[i].pid) {
+					i++;
+					continue;
+				}
+				st->scratch[n++] = st->recs[i++];
+			} else {
+				if (i < st->nr && st->recs[i].pid == d.pid)
+					i++;
+				st->scratch[n++] = d;
+				j++;
+			}
+		}
+
+		struct task_snapshot *tmp = st->recs;
+		size_t tmp_cap = st->cap;
+		st->recs = st->scratch;
+		st->cap = st->cap_scratch;
+		st->scratch = tmp;
+		st->cap_scratch = tmp_cap;
+		st->nr = n;
+	}
+
+	st->timestamp_ns = fh.timestamp_ns;
+	st->off += frame_size(&fh, r->hdr->record_size);
+	return 1;
+}
+
+int snap_reader_peek(const struct snap_reader *r, const struct snap_state *st, int64_t *timestamp_ns)
+{
+	struct snap_frame_header fh;
+
+	if (st->off + sizeof(fh) > r->size)
+		return 0;
+	memcpy(&fh, r->base + st->off, sizeof(fh));
+	if (!frame_valid(&fh, st->off, r->size, r->hdr->record_size))
+		return 0;
+	*timestamp_ns = fh.timestamp_ns;
+	return 1;
+}
+
+void snap_state_free(struct snap_state *st)
+{
+	free(st->recs);
+	free(st->scratch);
+	memset(st, 0, sizeof(*st));
+}
+
+/* ---------------------------------------------------------------- 导出 */
+
+static void json_write_str(FILE *f, const char *str, size_t max)
+{
+	fputc('"', f);
+	for (size_t i = 0; i < max && str[i]; i++) {
+		unsigned char c = str[i];
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+void snap_write_json(FILE *f, long long ts_sec, const struct task_snapshot *recs, size_t nr)
+{
+	fprintf(f, "{\"timestamp\":%lld,\"tasks\":[", ts_sec);
+
+	for (size_t i = 0; i < nr; i++) {
+		const struct task_snapshot *r = &recs[i];
+
+		if (i)
+			fprintf(f, ",");
+		fprintf(f, "{\"pid\":%u,\"tgid\":%u,\"comm\":", r->pid, r->tgid);
+		json_write_str(f, r->comm, sizeof(r->comm));
+		fprintf(
+			f,
+			",\"cgroup_id\":%llu,\"current_gua\":%u,\"assigned_cpu\":%u,\"current_element\":%u,\"enqueue_time\":%llu,"
+			"\"last_cpu\":%u,\"migrations\":%u,\"partner_pid\":%u,\"sum_exec_runtime\":%llu,"
+			"\"nvcsw\":%llu,\"nivcsw\":%llu,\"rss_pages\":%lld}",
+			(unsigned long long)r->cgrp_id,
+			r->current_gua,
+			r->assigned_cpu,
+			r->current_element,
+			(unsigned long long)r->enqueue_time,
+			r->last_cpu,
+			r->migrations,
+			r->partner_pid,
+			(unsigned long long)r->sum_exec_runtime,
+			(unsigned long long)r->nvcsw,
+			(unsigned long long)r->nivcsw,
+			(long long)r->rss_pages);
+	}
+
+	fprintf(f, "]}\n");
+}
+
+static void csv_write_str(FILE *f, const char *str, size_t max)
+{
+	fputc('"', f);
+	for (size_t i = 0; i < max && str[i]; i++) {
+		if (str[i] == '"')
+			fputc('"', f);
+		fputc(str[i], f);
+	}
+	fputc('"', f);
+}
+
+void snap_write_csv_header(FILE *f)
+{
+	fprintf(f, "timestamp,pid,tgid,comm,cgroup_id,current_gua,assigned_cpu,current_element,enqueue_time,"
+		   "last_cpu,migrations,partner_pid,sum_exec_runtime,nvcsw,nivcsw,rss_pages\n");
+}
+
+void snap_write_csv_rows(FILE *f, long long ts_sec, const struct task_snapshot *recs, size_t nr)
+{
+	for (size_t i = 0; i < nr; i++) {
+		const struct task_snapshot *r = &recs[i];
+
+		fprintf(f, "%lld,%u,%u,", ts_sec, r->pid, r->tgid);
+		csv_write_str(f, r->comm, sizeof(r->comm));
+		fprintf(
+			f,
+			",%llu,%u,%u,%u,%llu,%u,%u,%u,%llu,%llu,%llu,%lld\n",
+			(unsigned long long)r->cgrp_id,
+			r->current_gua,
+			r->assigned_cpu,
+			r->current_element,
+			(unsigned long long)r->enqueue_time,
+			r->last_cpu,
+			r->migrations,
+			r->partner_pid,
+			(unsigned long long)r->sum_exec_runtime,
+			(unsigned long long)r->nvcsw,
+			(unsigned long long)r->nivcsw,
+			(long long)r->rss_pages);
+	}
+}
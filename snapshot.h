@@ -0,0 +1,132 @@
+#ifndef SCX_SNAPSHOT_H
+#define SCX_SNAPSHOT_H
+
+/*
+ * 任务快照文件格式（.scxs）：单个只追加、可 mmap 的二进制文件，替代每个采样周期一份的 JSON/CSV。
+ *
+ *   文件头 snap_file_header
+ *   帧 0：snap_frame_header + nr_records 条 task_snapshot + nr_removed 个 pid
+ *   帧 1 ...
+ *
+ * 关键帧（SNAP_FRAME_KEY）包含全部任务；增量帧（SNAP_FRAME_DELTA）只包含新出现的任务、
+ * 以及任一字段（卦象、CPU、运行时间、切换次数等）发生变化的任务，外加已退出任务的 pid。每隔 keyframe_interval 帧写一个关键帧。
+ * 同名 .idx 文件按时间顺序记录每个关键帧的时间戳与偏移，用于按时间定位；缺失时读取方按帧头扫描重建。
+ * 所有整数均为小端序。
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SNAP_MAGIC          "SCXSNAP"   /* 8 字节，含结尾的 '\0' */
+#define SNAP_VERSION        1
+#define SNAP_FRAME_MAGIC    0x314d5246u /* "FRM1" */
+#define SNAP_KEYFRAME_DEFAULT 60
+
+enum snap_frame_type {
+	SNAP_FRAME_KEY = 1,
+	SNAP_FRAME_DELTA = 2,
+};
+
+/* 与 BPF 中的 task_snapshot 对齐（iter/task 输出的定长记录），同时也是快照文件中的记录格式 */
+struct task_snapshot {
+	uint32_t pid;
+	uint32_t tgid;
+	char comm[16];
+	uint64_t cgrp_id;
+	uint64_t sum_exec_runtime;
+	uint64_t nvcsw;
+	uint64_t nivcsw;
+	int64_t rss_pages;
+	uint64_t enqueue_time;
+	uint32_t current_gua;
+	uint32_t assigned_cpu;
+	uint32_t current_element;
+	uint32_t last_cpu;
+	uint32_t migrations;
+	uint32_t partner_pid;
+};
+
+struct snap_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;        /* sizeof(struct snap_file_header) */
+	uint32_t record_size;        /* sizeof(struct task_snapshot) */
+	uint32_t keyframe_interval;
+	int64_t created_ns;          /* 创建时间（CLOCK_REALTIME） */
+	uint8_t reserved[32];
+};
+
+struct snap_frame_header {
+	uint32_t magic;              /* SNAP_FRAME_MAGIC */
+	uint16_t type;               /* enum snap_frame_type */
+	uint16_t flags;
+	int64_t timestamp_ns;        /* 采样时间（CLOCK_REALTIME） */
+	uint32_t nr_records;
+	uint32_t nr_removed;
+	uint64_t prev_keyframe_off;  /* 上一个关键帧的文件偏移（自身为关键帧时指向自己） */
+};
+
+struct snap_index_entry {
+	int64_t timestamp_ns;
+	uint64_t offset;
+};
+
+/* 写入端：维护上一帧的任务集合，用于计算增量 */
+struct snap_writer {
+	FILE *f;
+	FILE *idx;
+	uint64_t off;                /* 下一帧的写入偏移 */
+	uint64_t last_keyframe_off;
+	uint32_t keyframe_interval;
+	uint32_t frames_since_key;
+	bool need_keyframe;
+	struct task_snapshot *prev;
+	size_t nr_prev, cap_prev;
+	struct task_snapshot *delta;
+	uint32_t *removed;
+	size_t cap_delta, cap_removed;
+};
+
+int snap_writer_open(struct snap_writer *w, const char *path, uint32_t keyframe_interval);
+/* recs 会按 pid 原地排序；返回写入的字节数，失败返回 -1 */
+long snap_writer_append(struct snap_writer *w, int64_t timestamp_ns, struct task_snapshot *recs, size_t nr);
+void snap_writer_close(struct snap_writer *w);
+
+/* 读取端：整个文件只读 mmap */
+struct snap_reader {
+	int fd;
+	const uint8_t *base;
+	size_t size;
+	const struct snap_file_header *hdr;
+	struct snap_index_entry *index;  /* 关键帧索引 */
+	size_t nr_index;
+};
+
+/* 回放状态：当前帧还原出的完整任务集合（按 pid 排序） */
+struct snap_state {
+	struct task_snapshot *recs;
+	size_t nr, cap;
+	int64_t timestamp_ns;
+	uint64_t off;                /* 下一帧的偏移 */
+	struct task_snapshot *scratch;
+	size_t cap_scratch;
+};
+
+int snap_reader_open(struct snap_reader *r, const char *path);
+void snap_reader_close(struct snap_reader *r);
+/* 定位到时间戳不晚于 timestamp_ns 的最后一个关键帧；timestamp_ns < 0 时定位到文件开头 */
+void snap_reader_seek(const struct snap_reader *r, struct snap_state *st, int64_t timestamp_ns);
+/* 读取并应用下一帧：返回 1 表示得到一个快照，0 表示到达末尾，-1 表示格式错误 */
+int snap_reader_next(const struct snap_reader *r, struct snap_state *st);
+/* 不读取帧内容，只取下一帧的时间戳：返回 1 表示存在下一帧，否则返回 0 */
+int snap_reader_peek(const struct snap_reader *r, const struct snap_state *st, int64_t *timestamp_ns);
+void snap_state_free(struct snap_state *st);
+
+/* 导出（sched 的 --format json/csv 与 scxsnap 共用） */
+void snap_write_json(FILE *f, long long ts_sec, const struct task_snapshot *recs, size_t nr);
+void snap_write_csv_header(FILE *f);
+void snap_write_csv_rows(FILE *f, long long ts_sec, const struct task_snapshot *recs, size_t nr);
+
+#endif /* SCX_SNAPSHOT_H */
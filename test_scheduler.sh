@@ -42,6 +42,11 @@ check_dependencies() {
         exit 1
     fi
     
+    if [ ! -f "./scxsnap" ]; then
+        log_error "快照工具 ./scxsnap 不存在，请先运行 make 编译"
+        exit 1
+    fi
+    
     if [ ! -f "./plot.py" ]; then
         log_error "绘图脚本 ./plot.py 不存在"
         exit 1
@@ -164,11 +169,50 @@ run_quick_test() {
     sleep 5
 }
 
+# 快照文件回放核对：同一次运行同时写 .scxs 与 CSV，逐个采样比较 scxsnap 的回放结果
+verify_snapshot_roundtrip() {
+    local dir="$OUTPUT_DIR/roundtrip"
+    local checked=0
+    local failed=0
+
+    log_info "核对快照文件回放结果..."
+    rm -rf "$dir"
+    mkdir -p "$dir"
+
+    # 关键帧间隔取小值，确保回放经过多个增量帧
+    ./sched -o "$dir" -i 1000 --format all --keyframe-every 4 < /dev/null > "$dir/sched.log" 2>&1 &
+    SCHED_PID=$!
+    stress-ng --cpu $((NUM_CPUS / 4)) --io 2 --timeout 10s > /dev/null 2>&1 || true
+    stop_scheduler
+
+    for csv in "$dir"/task_ctx_*.csv; do
+        [ -f "$csv" ] || continue
+        local ts
+        ts=$(basename "$csv" .csv)
+        ts=${ts#task_ctx_}
+        if ! ./scxsnap csv "$dir/task_ctx.scxs" --at "$ts" | diff -q - "$csv" > /dev/null; then
+            log_error "快照回放与 CSV 不一致: $csv"
+            failed=$((failed + 1))
+        fi
+        checked=$((checked + 1))
+    done
+
+    if [ $checked -eq 0 ]; then
+        log_error "未生成用于核对的采样"
+        return 1
+    fi
+    if [ $failed -ne 0 ]; then
+        log_error "快照回放核对失败: $failed/$checked 个采样不一致"
+        return 1
+    fi
+    log_info "快照回放核对通过 ($checked 个采样)"
+}
+
 # 生成图表
 generate_plots() {
     log_info "生成可视化图表..."
     
-    if [ ! -f "$OUTPUT_DIR/task_ctx_"*.json ]; then
+    if [ ! -f "$OUTPUT_DIR/task_ctx.scxs" ] && ! ls "$OUTPUT_DIR"/task_ctx_*.json >/dev/null 2>&1; then
         log_error "未找到采样数据文件"
         return 1
     fi
@@ -235,6 +279,8 @@ main() {
     log_info "测试完成"
     echo ""
     
+    verify_snapshot_roundtrip
+    
     generate_plots
     
     echo ""